@@ -0,0 +1,320 @@
+/*
+ * See LICENSE file for copyright and license details.
+ *
+ * benchmarks the steps of a run against a topology of the mock backend,
+ * see mock.c, for every config given, usually made by gencfg.c. Each step
+ * is repeated for at least BENCH_USEC and its time and allocations per
+ * call are printed. Allocations are counted by wrapping the allocator at
+ * link time, see the bench target of the Makefile, along with the libc
+ * functions that allocate through it internally, where the wrap of
+ * malloc() does not see them.
+ */
+
+/* the steps are the static functions of main.c, so it is built into this unit */
+#define main xrandrsetup
+#include "main.c"
+#undef main
+
+/* constants definition */
+#define BENCH_USEC 200000
+#define BENCH_RUNS 5 /* at the least, however long they take */
+
+/* structure definitions */
+typedef struct {
+	char *buf;
+	size_t len;
+	TomlArray *config;
+	CfgScreens *cs;
+	size_t *match;
+	size_t nmatch;
+	Layout l;
+} Bench;
+
+typedef struct {
+	const char *name;
+	const char *func;
+	void (*run)(Bench *b);
+} Step;
+
+/* function definitions */
+void* __real_calloc(size_t n, size_t size);
+FILE* __real_fopen(const char *path, const char *mode);
+ssize_t __real_getline(char **line, size_t *cap, FILE *fp);
+void* __real_malloc(size_t size);
+void* __real_realloc(void *ptr, size_t size);
+char* __real_strdup(const char *s);
+char* __real_strndup(const char *s, size_t n);
+void* __wrap_calloc(size_t n, size_t size);
+FILE* __wrap_fopen(const char *path, const char *mode);
+ssize_t __wrap_getline(char **line, size_t *cap, FILE *fp);
+void* __wrap_malloc(size_t size);
+void* __wrap_realloc(void *ptr, size_t size);
+char* __wrap_strdup(const char *s);
+char* __wrap_strndup(const char *s, size_t n);
+
+static void benchconfig(const char *path);
+static void benchstep(Bench *b, const Step *s);
+static void readconfig(Bench *b, const char *path);
+static void runmatch(Bench *b);
+static void runparse(Bench *b);
+static void runplan(Bench *b);
+static void runresolve(Bench *b);
+static void runscreens(Bench *b);
+static void start(void);
+static void stop(void);
+
+/* variable definitions */
+static unsigned long allocs = 0;
+static unsigned long stepallocs;
+static long long stepusec;
+static long long mark;
+static unsigned long markallocs;
+
+static const Step steps[] = {
+	/* name        measured function      run */
+	{ "parse",     "tomlgetconfig()",     runparse },
+	{ "screens",   "readscreens()",       runscreens },
+	{ "match",     "matchscreens()",      runmatch },
+	{ "resolve",   "setupmonitor()",      runresolve },
+	{ "plan",      "newplan()",           runplan },
+};
+
+void*
+__wrap_calloc(size_t n, size_t size)
+{
+	allocs++;
+	return __real_calloc(n, size);
+}
+
+/* the FILE and its buffer are allocated, counted as one */
+FILE*
+__wrap_fopen(const char *path, const char *mode)
+{
+	allocs++;
+	return __real_fopen(path, mode);
+}
+
+/* counted only when the line did not fit and the buffer was allocated or grown */
+ssize_t
+__wrap_getline(char **line, size_t *cap, FILE *fp)
+{
+	char *prev = *line;
+	size_t prevcap = *cap;
+	ssize_t ret;
+
+	ret = __real_getline(line, cap, fp);
+	if (*line != prev || *cap != prevcap)
+		allocs++;
+	return ret;
+}
+
+void*
+__wrap_malloc(size_t size)
+{
+	allocs++;
+	return __real_malloc(size);
+}
+
+void*
+__wrap_realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return __real_realloc(ptr, size);
+}
+
+char*
+__wrap_strdup(const char *s)
+{
+	allocs++;
+	return __real_strdup(s);
+}
+
+char*
+__wrap_strndup(const char *s, size_t n)
+{
+	allocs++;
+	return __real_strndup(s, n);
+}
+
+/* runs every step on the config at path, each on what the one before made */
+static void
+benchconfig(const char *path)
+{
+	Bench b;
+	FILE *fp;
+
+	memset(&b, 0, sizeof(b));
+	readconfig(&b, path);
+
+	if (!(fp = fmemopen(b.buf, b.len, "r")))
+		dielog("fmemopen()");
+	b.config = tomlgetconfig(fp, rootkeys);
+	fclose(fp);
+	if (!b.config) {
+		fprintf(stderr, "xrandr-setup-bench - invalid config: %s\n", path);
+		exit(1);
+	}
+	b.cs = readscreens(b.config);
+	b.match = matchscreens(b.cs, &b.nmatch);
+	if (b.nmatch)
+		loadlayout(&b.l, b.cs, &b.cs->s[b.match[0]]);
+	else
+		setupemptylayout(&b.l);
+	setuplayout(&b.l);
+
+	printf("\n%s: %zu screens, %zu monitors, %zu matching\n", path, b.cs->sc, b.cs->mc, b.nmatch);
+	printf("%-8s %-16s %8s %12s %12s\n", "step", "function", "runs", "us/run", "allocs/run");
+	for (size_t i = 0; i < LENGTH(steps); i++)
+		benchstep(&b, &steps[i]);
+
+	freelayout(&b.l);
+	free(b.match);
+	freescreens(b.cs);
+	tomldeletearray(b.config);
+	free(b.buf);
+}
+
+static void
+benchstep(Bench *b, const Step *s)
+{
+	unsigned long runs = 0;
+	long long total = 0;
+	unsigned long totalallocs = 0;
+
+	while (runs < BENCH_RUNS || total < BENCH_USEC) {
+		stepusec = 0;
+		stepallocs = 0;
+		s->run(b);
+		total += stepusec;
+		totalallocs += stepallocs;
+		runs++;
+	}
+
+	printf("%-8s %-16s %8lu %12.3f %12.1f\n", s->name, s->func, runs, (double) total / runs,
+	       (double) totalallocs / runs);
+}
+
+/* the config is read once, so the steps do not measure the disk */
+static void
+readconfig(Bench *b, const char *path)
+{
+	FILE *fp;
+	size_t cap = 0;
+	size_t n;
+
+	if (!(fp = fopen(path, "r")))
+		dielog("fopen()");
+
+	do {
+		while (cap < b->len + BUF_SIZE)
+			b->buf = grow(b->buf, cap, &cap, 1);
+		n = fread(b->buf + b->len, 1, BUF_SIZE, fp);
+		b->len += n;
+	} while (n == BUF_SIZE);
+
+	fclose(fp);
+}
+
+static void
+runmatch(Bench *b)
+{
+	size_t *match;
+	size_t n;
+
+	start();
+	match = matchscreens(b->cs, &n);
+	stop();
+	free(match);
+}
+
+static void
+runparse(Bench *b)
+{
+	TomlArray *config;
+	FILE *fp;
+
+	if (!(fp = fmemopen(b->buf, b->len, "r")))
+		dielog("fmemopen()");
+
+	start();
+	config = tomlgetconfig(fp, rootkeys);
+	stop();
+	fclose(fp);
+	tomldeletearray(config);
+}
+
+static void
+runplan(Bench *b)
+{
+	Plan p;
+
+	start();
+	newplan(&p, &b->l);
+	stop();
+	freeplan(&p);
+}
+
+/* every monitor of the matching layout, or of the basic one, is resolved against the snapshot */
+static void
+runresolve(Bench *b)
+{
+	Layout l = { 0, NULL, 0, NULL };
+
+	if (b->nmatch)
+		loadlayout(&l, b->cs, &b->cs->s[b->match[0]]);
+	else
+		setupemptylayout(&l);
+
+	start();
+	setuplayout(&l);
+	stop();
+	freelayout(&l);
+}
+
+static void
+runscreens(Bench *b)
+{
+	CfgScreens *cs;
+
+	start();
+	cs = readscreens(b->config);
+	stop();
+	freescreens(cs);
+}
+
+static void
+start(void)
+{
+	markallocs = allocs;
+	mark = getusec();
+}
+
+static void
+stop(void)
+{
+	stepusec += getusec() - mark;
+	stepallocs += allocs - markallocs;
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		fprintf(stderr, "usage: xrandr-setup-bench <topology> <config>...\n");
+		return 1;
+	}
+
+	if (setenv("XRANDR_SETUP_MOCK", argv[1], 1) < 0)
+		dielog("setenv()");
+	loglevel = LOG_ERROR;
+
+	setup();
+	probe(NULL, NULL, 0);
+
+	printf("%s: %zu outputs, %zu crtcs, %zu modes\n", argv[1], snap.noutput, snap.ncrtc, snap.nmode);
+	for (int i = 2; i < argc; i++)
+		benchconfig(argv[i]);
+
+	cleanup(NULL);
+	return 0;
+}
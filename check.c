@@ -0,0 +1,64 @@
+/*
+ * See LICENSE file for copyright and license details.
+ *
+ * checks that a config reads the same streamed one screen at a time, as
+ * applyfirst() does, and parsed whole, as readscreens() does, and that it
+ * has the number of screens and providers given. The configs of check/
+ * put the same tables in different orders, see the check target of the
+ * Makefile.
+ */
+
+/* the config is read by the static functions of main.c, so it is built into this unit */
+#define main xrandrsetup
+#include "main.c"
+#undef main
+
+int
+main(int argc, char *argv[])
+{
+	FILE *fp;
+	TomlArray *config;
+	CfgScreens *cs;
+	size_t nstream = 0;
+	size_t nscreen;
+	size_t nprovider;
+	int ok;
+
+	if (argc != 4) {
+		fprintf(stderr, "usage: xrandr-setup-check <config> <screens> <providers>\n");
+		return 1;
+	}
+	nscreen = strtoul(argv[2], NULL, 10);
+	nprovider = strtoul(argv[3], NULL, 10);
+
+	if (!(fp = fopen(argv[1], "r"))) {
+		fprintf(stderr, "xrandr-setup-check - failed to open %s - %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	config = tomlopen(fp, rootkeys);
+	fclose(fp);
+	if (!config) {
+		fprintf(stderr, "xrandr-setup-check - failed to read %s\n", argv[1]);
+		return 1;
+	}
+
+	while (tomlnext(config, "screen"))
+		nstream++;
+	if (tomlparse(config)) {
+		fprintf(stderr, "xrandr-setup-check - invalid config: %s\n", argv[1]);
+		tomldeletearray(config);
+		return 1;
+	}
+
+	logfd = STDERR_FILENO;
+	cs = readscreens(config);
+	tomldeletearray(config);
+	logflush();
+
+	ok = nstream == nscreen && cs->sc == nscreen && cs->pc == nprovider;
+	printf("%s: %zu streamed, %zu parsed screens, %zu providers, expected %zu and %zu: %s\n", argv[1],
+	       nstream, cs->sc, cs->pc, nscreen, nprovider, ok ? "ok" : "FAIL");
+
+	freescreens(cs);
+	return !ok;
+}
@@ -0,0 +1,131 @@
+/*
+ * See LICENSE file for copyright and license details.
+ *
+ * compiles a config into a header for the embed target: the flat screens,
+ * monitors, strings and providers with their signature index, exactly as
+ * readscreens() builds them at runtime, as static const arrays. Built with
+ * EMBED, xrandr-setup uses them when there is no config file, without
+ * reading, parsing or allocating anything.
+ */
+
+/* the config is built by the static functions of main.c, so it is built into this unit */
+#define main xrandrsetup
+#include "main.c"
+#undef main
+
+/* function definitions */
+static void printstrings(const CfgScreens *cs);
+
+/* every string of the pool is a literal of its own, so an escape never runs into the next */
+static void
+printstrings(const CfgScreens *cs)
+{
+	const unsigned char *c;
+
+	printf("static const char embedstrings[EMBED_NSTRING + 1] =");
+	for (size_t off = 0; off < cs->nstr; off += strlen(cs->str + off) + 1) {
+		printf("\n\t\"");
+		for (c = (const unsigned char*) cs->str + off; *c; c++) {
+			/* ? too, -std=c99 replaces trigraphs */
+			if (*c == '"' || *c == '\\' || *c == '?')
+				printf("\\%c", *c);
+			else if (*c >= ' ' && *c <= '~')
+				putchar(*c);
+			else
+				printf("\\%03o", *c);
+		}
+		printf("\\0\"");
+	}
+	printf(";\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	FILE *fp;
+	TomlArray *config;
+	CfgScreens *cs;
+	const CfgScreen *s;
+	const CfgMonitor *m;
+	uint64_t key = 14695981039346656037ULL;
+	int c;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: embedcfg <config>\n");
+		return 1;
+	}
+
+	if (!(fp = fopen(argv[1], "r"))) {
+		fprintf(stderr, "embedcfg - failed to open %s - %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+
+	/* FNV-1a of the file, it stands in for its mtime and size in the state */
+	while ((c = getc(fp)) != EOF) {
+		key ^= (unsigned char) c;
+		key *= 1099511628211ULL;
+	}
+	rewind(fp);
+
+	config = tomlgetconfig(fp, rootkeys);
+	fclose(fp);
+	if (!config) {
+		fprintf(stderr, "embedcfg - invalid config: %s\n", argv[1]);
+		return 1;
+	}
+
+	/* the options runtime parsing would warn about are reported in the build */
+	logfd = STDERR_FILENO;
+	cs = readscreens(config);
+	tomldeletearray(config);
+	logflush();
+
+	printf("/* generated by embedcfg from %s, do not edit */\n\n", argv[1]);
+	printf("#define EMBED_KEY 0x%016llxULL\n", (unsigned long long) key);
+	printf("#define EMBED_NSCREEN %zu\n", cs->sc);
+	printf("#define EMBED_NMONITOR %zu\n", cs->mc);
+	printf("#define EMBED_NSTRING %zu\n", cs->nstr);
+	printf("#define EMBED_NBUCKET %zu\n", cs->nbucket);
+	printf("#define EMBED_NPROVIDER %zu\n\n", cs->pc);
+
+	/* every array has a zeroed element more, so none is empty */
+	printf("static const CfgScreen embedscreens[EMBED_NSCREEN + 1] = {\n");
+	for (size_t i = 0; i < cs->sc; i++) {
+		s = &cs->s[i];
+		printf("\t{ .sig = 0x%016llxULL, .name = %lu, .dpi = %lu, .monitor = %lu, .nmonitor = %lu, .next = %lu },\n",
+		       (unsigned long long) s->sig, (unsigned long) s->name, (unsigned long) s->dpi,
+		       (unsigned long) s->monitor, (unsigned long) s->nmonitor, (unsigned long) s->next);
+	}
+	printf("\t{ .sig = 0 },\n};\n\n");
+
+	printf("static const CfgMonitor embedmonitors[EMBED_NMONITOR + 1] = {\n");
+	for (size_t i = 0; i < cs->mc; i++) {
+		m = &cs->m[i];
+		printf("\t{ .rate = %.17g, .tolerance = %.17g, .primary = %lu, .xoffset = %lu, .yoffset = %lu,\n"
+		       "\t  .xmode = %lu, .ymode = %lu, .rotation = %lu, .edid = %lu },\n",
+		       m->rate, m->tolerance, (unsigned long) m->primary, (unsigned long) m->xoffset,
+		       (unsigned long) m->yoffset, (unsigned long) m->xmode, (unsigned long) m->ymode,
+		       (unsigned long) m->rotation, (unsigned long) m->edid);
+	}
+	printf("\t{ .rate = 0 },\n};\n\n");
+
+	printf("static const uint32_t embedmids[EMBED_NMONITOR + 1] = {");
+	for (size_t i = 0; i < cs->mc; i++)
+		printf("%s%lu,", i % 8 ? " " : "\n\t", (unsigned long) cs->mid[i]);
+	printf("%s0,\n};\n\n", cs->mc % 8 ? " " : "\n\t");
+
+	printf("static const uint32_t embedbuckets[EMBED_NBUCKET + 1] = {");
+	for (size_t i = 0; i < cs->nbucket; i++)
+		printf("%s%lu,", i % 8 ? " " : "\n\t", (unsigned long) cs->bucket[i]);
+	printf("%s0,\n};\n\n", cs->nbucket % 8 ? " " : "\n\t");
+
+	printf("static const CfgProvider embedproviders[EMBED_NPROVIDER + 1] = {\n");
+	for (size_t i = 0; i < cs->pc; i++)
+		printf("\t{ .source = %lu, .sink = %lu },\n", (unsigned long) cs->p[i].source, (unsigned long) cs->p[i].sink);
+	printf("\t{ .source = 0 },\n};\n\n");
+
+	printstrings(cs);
+
+	freescreens(cs);
+	return ferror(stdout) || fflush(stdout) ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * See LICENSE file for copyright and license details.
+ *
+ * writes a synthetic config of a number of screens with a number of
+ * monitors each to stdout, for the benchmarks. The monitor ids are the
+ * outputs of the topology given, see mock.c, in turns, so every screen
+ * is indexed under another connected set and most of them do not match.
+ * The last screen is the connected outputs, so there is a layout to
+ * resolve and plan whatever the sizes.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* constants definition */
+#define BUF_SIZE 512
+#define MAX_OUTPUTS 64
+#define MODE_WIDTH 3840 /* the offsets leave room for the widest mode */
+
+/* function definitions */
+static void printmonitor(const char *id, size_t index);
+static void readtopology(const char *path);
+
+/* variable definitions */
+static char *names[MAX_OUTPUTS];
+static int connected[MAX_OUTPUTS];
+static size_t nname = 0;
+
+static void
+printmonitor(const char *id, size_t index)
+{
+	printf("\t[[monitor]]\n");
+	printf("\t\tid=\"%s\"\n", id);
+	if (!index)
+		printf("\t\tprimary=true\n");
+	else
+		printf("\t\txoffset=%zu\n", index * MODE_WIDTH);
+	if (index % 2)
+		printf("\t\trate=60\n");
+}
+
+static void
+readtopology(const char *path)
+{
+	FILE *fp;
+	char line[BUF_SIZE];
+	char name[BUF_SIZE];
+	char state[BUF_SIZE];
+
+	if (!(fp = fopen(path, "r"))) {
+		perror("gencfg: fopen()");
+		exit(1);
+	}
+
+	while (nname < MAX_OUTPUTS && fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "output %511s %511s", name, state) != 2)
+			continue;
+		if (!(names[nname] = strdup(name))) {
+			perror("gencfg: strdup()");
+			exit(1);
+		}
+		connected[nname++] = !strcmp(state, "connected");
+	}
+	fclose(fp);
+
+	if (!nname) {
+		fprintf(stderr, "gencfg: %s has no outputs\n", path);
+		exit(1);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	char id[BUF_SIZE];
+	size_t nscreen;
+	size_t nmonitor;
+	size_t count;
+
+	if (argc != 4 || (nscreen = strtoul(argv[1], NULL, 10)) < 1 || (nmonitor = strtoul(argv[2], NULL, 10)) < 1) {
+		fprintf(stderr, "usage: gencfg <screens> <monitors> <topology>\n");
+		return 1;
+	}
+	readtopology(argv[3]);
+
+	printf("# %zu screens of %zu monitors for %s\n", nscreen, nmonitor, argv[3]);
+	for (size_t i = 0; i + 1 < nscreen; i++) {
+		printf("\n[[screen]]\n\tname=\"Screen %zu\"\n", i + 1);
+		for (size_t j = 0; j < nmonitor; j++) {
+			/* more monitors than outputs never match, they are still matched against */
+			if (j < nname)
+				snprintf(id, sizeof(id), "%s", names[(i + j) % nname]);
+			else
+				snprintf(id, sizeof(id), "VIRTUAL-%zu", j - nname + 1);
+			printmonitor(id, j);
+		}
+	}
+
+	printf("\n[[screen]]\n\tname=\"Connected\"\n");
+	count = 0;
+	for (size_t i = 0; i < nname; i++) {
+		if (connected[i])
+			printmonitor(names[i], count++);
+	}
+
+	for (size_t i = 0; i < nname; i++)
+		free(names[i]);
+	return 0;
+}
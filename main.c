@@ -14,829 +14,4490 @@
 
 #define _POSIX_C_SOURCE 200809L
 #include <errno.h>
+#include <signal.h>
 #include <libgen.h>
 #include <limits.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include <X11/extensions/Xrandr.h>
 #include <X11/Xlib.h>
+#ifdef XCB
+#include <X11/Xlib-xcb.h>
+#include <xcb/randr.h>
+#endif
 
 #include "toml.h"
 
 /* constants definition */
 #define LOG_SIZE 256
+#define LOG_BUF_SIZE 4096 /* records kept before they are written to the log */
 #define BUF_SIZE 512
+#define PROMPT_BATCH 64 /* menu entries sent to the prompt per writev() */
+#define CONTROL_TIMEOUT 1000 /* ms the daemon waits for a command once a client connected */
+#define DEBOUNCE_MS 500 /* default quiet window of the daemon before applying */
+#define RATE_TOLERANCE 0.5 /* default max distance in Hz of a mode to the configured rate */
+#define CACHE_MAGIC 0x43535258 /* "XRSC" */
+#define CACHE_VERSION 4 /* bump whenever the cache layout or the parsing changes */
+#define CFG_NONE UINT32_MAX /* unset string of the config */
+#define SIG_EDID 0 /* signature of the screens with an EDID monitor, looked up for every connected set */
+
+/* macros */
+#define LENGTH(X) (sizeof X / sizeof X[0])
 
 /* paths definitions */
 const char *cfgpath[] = { "$XDG_CONFIG_HOME", "xrandr-setup", "xrandr-setup.toml", NULL};
+const char *cachepath[] = { "$XDG_CACHE_HOME", "xrandr-setup", "xrandr-setup.cache", NULL};
+const char *statepath[] = { "$XDG_STATE_HOME", "xrandr-setup", "xrandr-setup.state", NULL};
+const char *edidpath[] = { "$XDG_CACHE_HOME", "xrandr-setup", "edid.cache", NULL};
+const char *sockpath[] = { "$XDG_RUNTIME_DIR", "xrandr-setup.sock", NULL};
+const char *providerpath[] = { "$XDG_RUNTIME_DIR", "xrandr-setup.providers", NULL};
+const char *providercachepath[] = { "$XDG_CACHE_HOME", "xrandr-setup", "xrandr-setup.providers", NULL};
+const char *bootidpath = "/proc/sys/kernel/random/boot_id";
 const char *logpath[] = {"$HOME", "window-manager.log", NULL};
 const char *pmtpath[] = { "usr", "local", "bin", "dmenu", NULL};
 
+/* where the XDG base directories default to under $HOME */
+const char *xdgdefaults[][2] = {
+	{ "XDG_CONFIG_HOME", "/.config" },
+	{ "XDG_CACHE_HOME",  "/.cache" },
+	{ "XDG_STATE_HOME",  "/.local/state" },
+};
+
+/* enums */
+enum { PROBE_AUTO, PROBE_CURRENT, PROBE_FULL }; /* probe policies */
+enum { LOG_ERROR, LOG_WARN, LOG_INFO, LOG_DEBUG }; /* log levels */
+enum { PHASE_CONNECT, PHASE_PROBE, PHASE_PROVIDER, PHASE_STATE, PHASE_CONFIG, PHASE_MATCH,
+       PHASE_PROMPT, PHASE_RESOLVE, PHASE_APPLY, PHASE_LAST }; /* timed phases */
+
 /* structure definitions */
+
+/*
+ * the config is stored flat, exactly as in the binary cache: every screen
+ * refers to a range of one monitor array, the monitor ids used for matching
+ * are kept apart from the options only read on apply, and all strings are
+ * offsets into one pool
+ */
+typedef struct {
+	double rate;
+	double tolerance;
+	uint32_t primary;
+	uint32_t xoffset;
+	uint32_t yoffset;
+	uint32_t xmode;
+	uint32_t ymode;
+	uint32_t rotation;
+	uint32_t edid; /* 1 if its id is an EDID fingerprint */
+	uint32_t pad;
+} CfgMonitor;
+
+typedef struct {
+	uint64_t sig; /* of the monitor ids, see indexscreens() */
+	uint32_t name;
+	uint32_t dpi;
+	uint32_t monitor; /* index of the first monitor */
+	uint32_t nmonitor;
+	uint32_t next; /* next screen + 1 of the same bucket, 0 ends the chain */
+	uint32_t pad;
+} CfgScreen;
+
+/* the outputs of the sink provider display what the source renders */
+typedef struct {
+	uint32_t source;
+	uint32_t sink;
+} CfgProvider;
+
+typedef struct {
+	size_t sc;
+	CfgScreen *s;
+	size_t mc;
+	CfgMonitor *m;
+	uint32_t *mid;
+	size_t nstr;
+	char *str;
+	size_t nbucket;
+	uint32_t *bucket;
+	size_t pc;
+	CfgProvider *p;
+
+	/* capacities while parsing, or the cache everything points into */
+	size_t capscreen;
+	size_t capmonitor;
+	size_t capprovider;
+	size_t capstr;
+	void *map;
+	size_t maplen;
+	int embedded; /* compiled in, see embedcfg.c, nothing is freed */
+} CfgScreens;
+
+/* a monitor of the layout being applied, filled in against the snapshot */
 typedef struct {
 	RRMode rid;
 	char *id;
+	char *edid; /* only while parsing, it then replaces the id */
 	double rate;
+	double tolerance;
 	unsigned int primary;
 	unsigned int xoffset;
 	unsigned int yoffset;
 	unsigned int xmode;
 	unsigned int ymode;
-	unsigned int moderot;
-	Rotation rotation;
-} CfgMonitor;
+	unsigned int rotation;
+} LayoutMonitor;
 
 typedef struct {
 	unsigned int dpi;
 	char *name;
 	size_t mc;
-	CfgMonitor **m;
-} CfgScreen;
+	LayoutMonitor *m;
+} Layout;
 
+/* a provider link, by name */
 typedef struct {
-	size_t sc;
-	CfgScreen **s;
-} CfgScreens;
+	char *source;
+	char *sink;
+} ProviderLink;
+
+typedef struct {
+	RRMode id;
+	unsigned int width;
+	unsigned int height;
+	double rate;
+} SnapMode;
+
+typedef struct {
+	RROutput id;
+	char *name;
+	Connection connection;
+	RRCrtc crtc;
+	int ncrtc;
+	RRCrtc *crtcs;
+	int nmode;
+	int npreferred;
+	RRMode *modes;
+	int nsorted;
+	SnapMode **sorted; /* by width, height and rate, all descending */
+	char *edid; /* fingerprint, NULL until fetchedids() and empty without an EDID */
+	int stale;
+} SnapOutput;
+
+typedef struct {
+	RRCrtc id;
+	Time timestamp;
+	int x;
+	int y;
+	unsigned int width;
+	unsigned int height;
+	RRMode mode;
+	Rotation rotation;
+	Rotation rotations;
+	int noutput;
+	RROutput *outputs;
+	int stale;
+} SnapCrtc;
+
+/* state of every output and crtc, fetched once and read by all phases */
+typedef struct {
+	size_t noutput;
+	SnapOutput *outputs;
+	size_t ncrtc;
+	SnapCrtc *crtcs;
+	size_t nmode;
+	SnapMode *modes; /* by id */
+	RROutput primary;
+} Snapshot;
+
+typedef struct {
+	const SnapCrtc *cur;
+	const SnapOutput *output;
+	int x;
+	int y;
+	RRMode mode;
+	Rotation rotation;
+	int disable; /* turned off before the framebuffer is resized and the others are set */
+} PlanCrtc;
+
+/*
+ * the binary config cache: a header, then the screens, the monitors, the
+ * monitor ids, the signature buckets, the providers and the string pool of
+ * CfgScreens, all in native byte order
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t mtime; /* of the config in ns, with size, inode and device the cache key */
+	uint64_t size;
+	uint64_t ino;
+	uint64_t dev;
+	uint32_t nscreen;
+	uint32_t nmonitor;
+	uint32_t nbucket;
+	uint32_t nstring;
+	uint32_t nprovider;
+	uint32_t pad;
+} CacheHeader;
+
+typedef struct {
+	char *name;
+	int x;
+	int y;
+	RRMode mode;
+	Rotation rotation;
+} StateOutput;
+
+/*
+ * what was applied last for one set of connected outputs, one tab separated
+ * line of the state file: the signature, the mtime in ns and size of the
+ * config, the screen name, the primary output, then one space separated
+ * "name x y mode rotation" per output
+ */
+typedef struct {
+	uint64_t sig;
+	uint64_t mtime;
+	uint64_t size;
+	char *name; /* of the screen, empty for the default layout */
+	char *primary; /* empty if the layout has none */
+	size_t noutput;
+	StateOutput *outputs;
+	char *line; /* holds the strings */
+} StateRecord;
+
+/* the menu application, spawned before probing so it starts up meanwhile */
+typedef struct {
+	pid_t pid; /* -1 if it failed to spawn */
+	int in; /* its stdin */
+	int out; /* its stdout */
+} Prompt;
+
+/* what a phase cost since the timings were last logged */
+typedef struct {
+	unsigned int runs;
+	long long usec;
+	unsigned long requests;
+	unsigned long roundtrips;
+} Phase;
+
+/* the changes needed to get from the snapshot to a layout */
+typedef struct {
+	size_t ncrtc;
+	PlanCrtc *crtcs;
+	const SnapOutput *primary; /* NULL if unchanged */
+	int resize;
+	int ordered; /* resized once between disabling and setting the crtcs */
+	unsigned int width;
+	unsigned int height;
+	unsigned int mmwidth;
+	unsigned int mmheight;
+	XRRScreenSize cur;
+} Plan;
 
 /* function definitions */
+static void applydefault(const CfgScreens *cs);
+static int applyfirst(TomlArray *config);
+static int applyplan(const Plan *p);
+static void applyscreen(const CfgScreens *cs, const CfgScreen *sel, int record);
+static void assigncrtcs(const SnapOutput **out, size_t n, int *crtc);
+static int augmentcrtc(const SnapOutput **out, int *owner, char *seen, int *crtc, size_t i);
+static int checkcache(const void *map, size_t len, const struct stat *st);
+static int checkstate(void);
 static void cleanup(CfgScreens *cs);
+static void clearsnapcrtc(SnapCrtc *c);
+static void clearsnapoutput(SnapOutput *o);
+static void closeprompt(Prompt *p);
+static int cmpedid(const char *key, const char *fp);
+static int cmpmodeid(const void *a, const void *b);
+static int cmpmodesize(const void *a, const void *b);
+static int cmpscreen(const CfgScreens *a, const CfgScreen *sa, const CfgScreens *b, const CfgScreen *sb);
+static int cmpsize(const void *a, const void *b);
+static int cmpstr(const void *a, const void *b);
+static int connectdaemon(void);
+static void countroundtrip(void);
 static void dielog(const char *func);
-static void freemonitor(CfgMonitor *m);
-static void freescreen(CfgScreen *s);
+static void fetchedids(void);
+static void fetchsnapshot(void);
+static char* findedid(const char *key);
+static int forkdisplays(char *list, int *status);
+static void freeconnected(char **id, size_t mc);
+static void freelayout(Layout *l);
+static void freeplan(Plan *p);
 static void freescreens(CfgScreens *cs);
-static CfgScreens* getcfgscreens(void);
+static void freesnapshot(void);
+static void freestate(StateRecord *r);
+static int getbootid(char *buf, size_t size);
+static void getcfgkey(uint64_t *mtime, uint64_t *size);
+static CfgScreens* getcfgscreens(int *applied);
 static FILE* getcfgstream(void);
-static int getinputscreen(CfgScreens *cs, char *argv[]);
+static char** getconnected(size_t *mc);
+static int getinputscreen(const CfgScreens *cs, const size_t *match, size_t n, Prompt *p);
+static long long getmsec(void);
+static uint64_t getmtime(const struct stat *st);
 static char* getpath(const char **arr);
-static int getpromptoption(const char *menu, char *argv[]);
+static size_t getpinnedscreen(const CfgScreens *cs, const size_t *match, size_t n);
+static uint64_t getsignature(void);
+static SnapCrtc* getsnapcrtc(RRCrtc id);
+static SnapMode* getsnapmode(RRMode id);
+static char* getsockpath(void);
+static char* getstring(const CfgScreens *cs, uint32_t off);
+static char* gettmppath(const char *path);
+static long long getusec(void);
+static void* grow(void *ptr, size_t n, size_t *cap, size_t size);
+static void indexmodes(void);
+static void indexscreens(CfgScreens *cs);
+static void initmonitor(LayoutMonitor *m);
+static int linkproviders(CfgScreens **cs);
+static int listensocket(void);
+static CfgScreens* loadcache(const struct stat *st);
+static void loadlayout(Layout *l, const CfgScreens *cs, const CfgScreen *s);
+static int loadstate(uint64_t sig, StateRecord *r);
+static int lockpath(const char *path);
+static void logfields(const char *table, const TomlField *fields, size_t nfield);
+static void logflush(void);
+static void logplan(const Plan *p);
 static void logstring(const char *string);
-static void matchscreens(CfgScreens *cs);
-static void newmonitor(CfgScreen *s);
-static void newscreen(CfgScreens *ss);
-static void setupmonitor(CfgMonitor *m, XRROutputInfo *output);
+static void logtimings(const char *run);
+static void makedirs(char *path);
+static int matchscreen(const CfgScreens *cs, const CfgScreen *s, char **id, size_t mc);
+static size_t* matchscreens(const CfgScreens *cs, size_t *n);
+static void newplan(Plan *p, const Layout *l);
+static void newsnapshot(void);
+static void parsemonitor(CfgScreens *cs, TomlArray *monitor);
+static void parseprovider(CfgScreens *cs, TomlArray *provider);
 static void parsescreen(CfgScreens *cs, TomlArray *screen);
 static void printhelp(void);
-static void removescreen(CfgScreens *cs, const int index);
-static void setscreen(CfgScreen *s);
+static void probe(const CfgScreens *cs, const RROutput *ids, size_t n);
+static int probestale(const CfgScreens *cs);
+static uint32_t pushstring(CfgScreens *cs, const char *str);
+static char* readedid(const SnapOutput *o);
+static int readcontrol(int fd, char *cmd, size_t *len);
+static CfgScreens* readscreens(TomlArray *config);
+static int readwatch(int fd, const char *name);
+static void refreshsnapshot(const RROutput *ids, size_t n);
+static int reloadscreens(CfgScreens **cs);
+static void rollbackplan(const Plan *p);
+static const char* rotationname(Rotation rotation);
+static int runclient(int fd, char *argv[], const char *command);
+static void rundaemon(CfgScreens *cs);
+static void savecache(const CfgScreens *cs, const struct stat *st);
+static void savestate(const Layout *l, const char *name);
+static char* senddaemon(int fd, const char *command);
+static int sendplan(const Plan *p);
+static void servecontrol(int fd, const char *cmd, CfgScreens **cs);
+static Status setcrtc(const SnapCrtc *c, Time timestamp, int x, int y, RRMode mode, Rotation rotation,
+                      RROutput *outputs, int noutput);
+static int setlayout(Layout *l);
+static int setphase(int phase);
+static int setproviders(const ProviderLink *links, size_t n);
 static void setup(void);
-static void setupemptyscreen(CfgScreen **s);
-static void setupmonitor(CfgMonitor *m, XRROutputInfo *output);
-static void setupscreen(CfgScreen *s);
-static void setupscreensize(CfgScreen *s, const unsigned int retract);
+static void setupemptylayout(Layout *l);
+static void setuplayout(Layout *l);
+static void setupmonitor(LayoutMonitor *m, const SnapOutput *output);
+static uint64_t signature(char **id, size_t n);
+static void spawnprompt(Prompt *p, char *argv[]);
+static uint64_t statekey(uint64_t sig);
+static char* streamprompt(Prompt *p, const CfgScreens *cs, const size_t *match, size_t n);
+static int watchconfig(char *name, size_t size);
+static int writeall(int fd, const void *buf, size_t len);
+static int xerrorhandler(Display *d, XErrorEvent *ee);
 
 /* variable definitions */
 static Display *dpy = NULL;
 static XRRScreenResources *resources = NULL;
+static uint64_t fullsig; /* the connected set of the last full probe */
+static int fullprobed = 0;
+static Snapshot snap;
 static Window root;
+static unsigned int debounce = DEBOUNCE_MS;
+static int probemode = PROBE_AUTO;
+static int xerror = 0;
+static const char *dpyname = NULL; /* set in the process of each display of --displays */
+static int loglevel = LOG_INFO;
+static int logfd = -1; /* -2 once the log failed to open */
+static char logbuf[LOG_BUF_SIZE];
+static size_t loglen = 0;
 
-static void
-cleanup(CfgScreens *cs)
-{
-	freescreens(cs);
-	if (resources) {
-		XRRFreeScreenResources(resources);
-		resources = NULL;
-	}
-	if (dpy) {
-		XCloseDisplay(dpy);
-		dpy = NULL;
-	}
-}
+static int timings = 0; /* 1 prints the phase timings, 2 also logs them as JSON */
+static int curphase = -1;
+static long long phasemark;
+static unsigned long phasereq;
+static uint32_t xcbrequest = 0; /* last request sent through XCB, unseen by Xlib until it sends one */
+static Phase phases[PHASE_LAST];
 
-static void
-dielog(const char *func)
-{
-	char log[LOG_SIZE];
+static const char *phasenames[] = {
+	[PHASE_CONNECT] = "connect",
+	[PHASE_PROBE]   = "probe",
+	[PHASE_PROVIDER] = "provider",
+	[PHASE_STATE]   = "state",
+	[PHASE_CONFIG]  = "config",
+	[PHASE_MATCH]   = "match",
+	[PHASE_PROMPT]  = "prompt",
+	[PHASE_RESOLVE] = "resolve",
+	[PHASE_APPLY]   = "apply",
+};
 
-	sprintf(log, "ERROR - %s failed - %s", func, strerror(errno));
-	logstring(log);
-	exit(errno);
-}
+/* by level, the prefixes of the records and the names of --log */
+static const char *loglevels[] = { "ERROR", "WARN", "INFO", "DEBUG" };
 
-static void
-freemonitor(CfgMonitor *m)
-{
-	if (!m)
-		return;
+/* config options, resolved against each loaded document by tomlresolve() */
+static const TomlEnum rotations[] = {
+	{ "normal",   RR_Rotate_0 },
+	{ "inverted", RR_Rotate_180 },
+	{ "left",     RR_Rotate_270 },
+	{ "right",    RR_Rotate_90 },
+	{ NULL,       0 },
+};
 
-	if (m->id)
-		free(m->id);
+static TomlField monitorfields[] = {
+	/* key          type          destination                        enums */
+	{ "id",         TOML_STRING,  offsetof(LayoutMonitor, id),          NULL,      0, 0 },
+	{ "edid",       TOML_STRING,  offsetof(LayoutMonitor, edid),        NULL,      0, 0 },
+	{ "primary",    TOML_BOOL,    offsetof(LayoutMonitor, primary),     NULL,      0, 0 },
+	{ "xoffset",    TOML_UINT,    offsetof(LayoutMonitor, xoffset),     NULL,      0, 0 },
+	{ "yoffset",    TOML_UINT,    offsetof(LayoutMonitor, yoffset),     NULL,      0, 0 },
+	{ "xmode",      TOML_UINT,    offsetof(LayoutMonitor, xmode),       NULL,      0, 0 },
+	{ "ymode",      TOML_UINT,    offsetof(LayoutMonitor, ymode),       NULL,      0, 0 },
+	{ "rate",       TOML_DOUBLE,  offsetof(LayoutMonitor, rate),        NULL,      0, 0 },
+	{ "tolerance",  TOML_DOUBLE,  offsetof(LayoutMonitor, tolerance),   NULL,      0, 0 },
+	{ "rotation",   TOML_ENUM,    offsetof(LayoutMonitor, rotation),    rotations, 0, 0 },
+};
 
-	free(m);
-	m = NULL;
-}
+/* the arrays of the config that never nest in the table before them */
+static const char *rootkeys[] = { "provider", "screen", NULL };
 
-static void
-freescreen(CfgScreen *s)
-{
-	if (!s)
-		return;
+static TomlField providerfields[] = {
+	/* key          type          destination                        enums */
+	{ "source",     TOML_STRING,  offsetof(ProviderLink, source), NULL,      0, 0 },
+	{ "sink",       TOML_STRING,  offsetof(ProviderLink, sink),   NULL,      0, 0 },
+};
 
-	for (size_t j = 0; j < s->mc; j++) {
-		freemonitor(s->m[j]);
-	}
+static TomlField screenfields[] = {
+	/* key          type          destination                        enums */
+	{ "name",       TOML_STRING,  offsetof(Layout, name),         NULL,      0, 0 },
+	{ "dpi",        TOML_UINT,    offsetof(Layout, dpi),          NULL,      0, 0 },
+};
 
-	free(s->m);
-	free(s->name);
-	free(s);
-	s = NULL;
-}
+#ifdef EMBED
+/* the config compiled in by the embed target, read only like the mapped cache */
+#include "embed.h"
 
+static CfgScreens embedded = {
+	.sc       = EMBED_NSCREEN,
+	.s        = (CfgScreen*) embedscreens,
+	.mc       = EMBED_NMONITOR,
+	.m        = (CfgMonitor*) embedmonitors,
+	.mid      = (uint32_t*) embedmids,
+	.nstr     = EMBED_NSTRING,
+	.str      = (char*) embedstrings,
+	.nbucket  = EMBED_NBUCKET,
+	.bucket   = (uint32_t*) embedbuckets,
+	.pc       = EMBED_NPROVIDER,
+	.p        = (CfgProvider*) embedproviders,
+	.embedded = 1,
+};
+#endif /* EMBED */
+
+/* applies the pinned or first layout matching the connected outputs, leaving cs intact */
 static void
-freescreens(CfgScreens *cs)
+applydefault(const CfgScreens *cs)
 {
-	if (!cs)
-		return;
+	size_t *match;
+	size_t n;
+	size_t pin = 0;
+	int prev;
 
-	for (size_t i = 0; i < cs->sc; i ++)
-		freescreen(cs->s[i]);
+	prev = setphase(PHASE_MATCH);
+	match = matchscreens(cs, &n);
+	if (n)
+		pin = getpinnedscreen(cs, match, n);
+	setphase(prev);
 
-	free(cs);
-	cs = NULL;
+	applyscreen(cs, n ? &cs->s[match[pin]] : NULL, 1);
+	free(match);
 }
 
-static CfgScreens*
-getcfgscreens(void)
+/*
+ * parses the config one screen at a time and applies the first one that
+ * matches the connected outputs, or the pinned one if it was selected for
+ * them, so the time to apply depends on where the match is and not on the
+ * size of the config. Returns 1 if it applied one.
+ */
+static int
+applyfirst(TomlArray *config)
 {
-	FILE *fp;
 	CfgScreens *cs;
-	TomlArray *config = NULL;
-	TomlArrayKey *screens = NULL;
+	TomlArray *screen;
+	StateRecord r;
+	const char *name;
+	char **id;
+	size_t mc;
+	int pinned;
+	int prev;
+	int applied = 0;
 
-	if (!(fp = getcfgstream()))
-		return NULL;
-	
-	config = tomlgetconfig(fp);
-	fclose(fp);
+	id = getconnected(&mc);
+	pinned = loadstate(signature(id, mc), &r) && r.name[0];
 
-	if (!config) {
-		return NULL;
-	}
+	if (!(cs = calloc(1, sizeof(CfgScreens))))
+		dielog("calloc()");
 
-	if (!(cs = malloc(sizeof(CfgScreens))))
-		dielog("malloc()");
+	while (!applied && (screen = tomlnext(config, "screen"))) {
+		/* only the screen being evaluated is kept */
+		cs->sc = 0;
+		cs->mc = 0;
+		cs->nstr = 0;
+		pushstring(cs, "");
 
-	cs->sc = 0;
-	cs->s = NULL;
+		tomlresolve(config, monitorfields, LENGTH(monitorfields));
+		tomlresolve(config, screenfields, LENGTH(screenfields));
+		parsescreen(cs, screen);
 
-	if (!(screens = tomlgetarraykey(config, "screen"))) {
-		tomldeletearray(config);
-		return cs;
-	}
+		name = getstring(cs, cs->s[0].name);
+		if (pinned && (!name || strcmp(name, r.name)))
+			continue;
 
-	for (size_t i = 0; i < screens->narr; i++)
-		parsescreen(cs, screens->arr[i]);
+		prev = setphase(PHASE_MATCH);
+		applied = matchscreen(cs, &cs->s[0], id, mc);
+		setphase(prev);
 
-	tomldeletearray(config);
-	return cs;
+		if (applied)
+			applyscreen(cs, &cs->s[0], 1);
+	}
+
+	/* without the pinned screen the first match is left to the full config */
+	freestate(&r);
+	freeconnected(id, mc);
+	freescreens(cs);
+	return applied;
 }
 
-static FILE*
-getcfgstream(void)
+/*
+ * applies the plan as one transaction. The server is grabbed so other
+ * clients only see the final layout, and if any change fails the previous
+ * state of the snapshot is restored before the grab is released.
+ */
+static int
+applyplan(const Plan *p)
 {
-	FILE *fp;
-	char *path;
+	XErrorHandler xerrorxlib;
+	int ret;
 
-	path = getpath(cfgpath);
-	if (access(path, F_OK)) {
-		char log[LOG_SIZE];
+	if (!p->ncrtc && !p->primary && !p->resize)
+		return 0;
 
-		sprintf(log, "WARN - File: %s does not exist", path);
-		logstring(log);
-		return NULL;
-	}
+	XGrabServer(dpy);
+	xerror = 0;
+	xerrorxlib = XSetErrorHandler(xerrorhandler);
 
-	if (!(fp = fopen(path, "r"))) {
+	ret = sendplan(p);
+	XSync(dpy, False);
+	countroundtrip();
+
+	if (ret || xerror) {
 		char log[LOG_SIZE];
 
-		sprintf(log, "ERROR - Failed to open file: %s - %s", path, strerror(errno));
+		snprintf(log, sizeof(log), "ERROR - Applying the layout failed (status %d, X error %d), restoring the previous one",
+		         ret, xerror);
 		logstring(log);
-		exit(errno);
+		rollbackplan(p);
+		XSync(dpy, False);
+		countroundtrip();
+		ret = 1;
 	}
 
-	return fp;
+	XSetErrorHandler(xerrorxlib);
+	XUngrabServer(dpy);
+	XFlush(dpy);
+	return ret;
 }
 
-static int
-getinputscreen(CfgScreens *cs, char *argv[])
+/*
+ * applies a working copy of the selected screen, as resolving the modes
+ * fills it in, or every connected output at its defaults without one.
+ * With record the result is saved as the state of the connected outputs.
+ */
+static void
+applyscreen(const CfgScreens *cs, const CfgScreen *sel, int record)
 {
-	size_t pstrs;
-	char *pstr;
-	char buffer[BUF_SIZE];
-	char ret;
+	Layout l = { 0, NULL, 0, NULL };
+	int prev;
 
-	if (cs->sc < 1)
-		return -1;
+	prev = setphase(PHASE_RESOLVE);
+	if (sel)
+		loadlayout(&l, cs, sel);
+	else
+		setupemptylayout(&l);
 
-	if (!(pstr = malloc(sizeof(char)))) {
-		cleanup(cs);
-		dielog("malloc()");
+	/* the name is cleared if setlayout() fell back to the default layout */
+	setuplayout(&l);
+	if (!setlayout(&l) && record) {
+		setphase(PHASE_STATE);
+		savestate(&l, l.name ? l.name : "");
 	}
+	freelayout(&l);
+	setphase(prev);
+}
 
-	pstr[0] = '\0';
-	pstrs = 1;
-
-	for (size_t i = 0; i < cs->sc; i++) {
-		int ret = snprintf(buffer, sizeof(buffer), "%s\t%zu\n", cs->s[i]->name, i);
-		
-		if ((size_t) ret > sizeof(buffer) - 1 || ret < 0) {
-			logstring("ERROR - snprintf() failed - buffer overflow (or encoding error)");
-			free(pstr);
-			cleanup(cs);
-			exit(errno);
-		}
+/*
+ * assigns a crtc to each output, a bipartite matching of the outputs to
+ * their possible crtcs. The crtc driving an output is kept if it can be,
+ * since moving it costs a modeset, and augmenting paths then find one for
+ * the others, moving kept outputs only to make room. Each crtc[i] is set
+ * to the index in the snapshot of the crtc of out[i], or -1 if none is left.
+ */
+static void
+assigncrtcs(const SnapOutput **out, size_t n, int *crtc)
+{
+	const SnapCrtc *c;
+	int *owner;
+	char *seen;
 
-		pstrs += strlen(buffer);
+	if (!(owner = malloc((snap.ncrtc + 1) * sizeof(int))))
+		dielog("malloc()");
+	if (!(seen = malloc(snap.ncrtc + 1)))
+		dielog("malloc()");
+	for (size_t i = 0; i < snap.ncrtc; i++)
+		owner[i] = -1;
 
-		if (!(pstr = realloc(pstr, pstrs * sizeof(char)))) {
-			cleanup(cs);
-			dielog("realloc()");
+	for (size_t i = 0; i < n; i++) {
+		crtc[i] = -1;
+		if (!(c = getsnapcrtc(out[i]->crtc)) || owner[c - snap.crtcs] >= 0)
+			continue;
+		for (int j = 0; j < out[i]->ncrtc; j++) {
+			if (out[i]->crtcs[j] == c->id) {
+				crtc[i] = (int) (c - snap.crtcs);
+				owner[crtc[i]] = (int) i;
+			}
 		}
-		strcat(pstr, buffer);
 	}
-	if (pstr[pstrs - 2] == '\n')
-		 pstr[pstrs - 2] = '\0';
-	
-	ret = getpromptoption(pstr, argv);
-	free(pstr);
 
-	if (ret < 0) {
-		cleanup(cs);
-		exit(0);
+	for (size_t i = 0; i < n; i++) {
+		if (crtc[i] >= 0)
+			continue;
+		memset(seen, 0, snap.ncrtc);
+		augmentcrtc(out, owner, seen, crtc, i);
 	}
 
-	return ret;
+	free(owner);
+	free(seen);
 }
 
-static char*
-getpath(const char **arr)
+/*
+ * finds a crtc for out[i], a free one first and else one whose output can
+ * move to another, returns 1 if it found one
+ */
+static int
+augmentcrtc(const SnapOutput **out, int *owner, char *seen, int *crtc, size_t i)
 {
-	
-	char *path;
-	char *env;
-	size_t spath = 1;
-	
-	if (!(path = malloc(sizeof(char))))
-		dielog("malloc()");
-	path[0] = '\0';
+	const SnapCrtc *c;
+	size_t k;
 
-	for (int i = 0; arr[i] != NULL; i++) {
-		if (arr[i][0] == '$') {
-			if ((env = getenv(arr[i] + 1))) {
-				spath += strlen(env);
-				if(!(path = realloc(path, spath * sizeof(char))))
-					dielog("realloc()");
-				strcat(path, env);
+	for (int pass = 0; pass < 2; pass++) {
+		for (int j = 0; j < out[i]->ncrtc; j++) {
+			if (!(c = getsnapcrtc(out[i]->crtcs[j])) || seen[k = (size_t) (c - snap.crtcs)])
 				continue;
-			}
-
-			if (!strcmp(arr[i] + 1, "XDG_CONFIG_HOME")) {
-				if (!(env = getenv("HOME"))) {
-					fprintf(stderr, "ERROR - Failed to get env variable: HOME - %s\n", strerror(errno));
-					exit(errno);
-				}
-				spath += strlen(env) + strlen("/.config");
-				if(!(path = realloc(path, spath * sizeof(char))))
-					dielog("realloc()");
-				strcat(path, env);
-				strcat(path, "/.config");
+			if (!pass && owner[k] >= 0)
 				continue;
-			}
 
-			fprintf(stderr, "ERROR - Failed to get env variable: %s - %s\n", arr[i], strerror(errno));
-			exit(errno);
-		} else {
-			spath += strlen(arr[i]) + 1;
-			if(!(path = realloc(path, spath * sizeof(char))))
-				dielog("realloc()");
-			strcat(path, "/");
-			strcat(path, arr[i]);
+			seen[k] = 1;
+			if (owner[k] < 0 || augmentcrtc(out, owner, seen, crtc, (size_t) owner[k])) {
+				owner[k] = (int) i;
+				crtc[i] = (int) k;
+				return 1;
+			}
 		}
 	}
 
-	return path;
+	return 0;
 }
 
-/* spawns the prompt application and returns the index of the selected screen */
+/* returns 1 if the cache map was built from the config described by st and is consistent */
 static int
-getpromptoption(const char *menu, char *argv[])
+checkcache(const void *map, size_t len, const struct stat *st)
 {
-	int option;
-	int writepipe[2];
-	int readpipe[2];
-	char buffer[BUF_SIZE];
-	char *path;
-	char **args;
-	char *name = NULL;
-	char *ptr;
-	size_t argc = 0;
+	const CacheHeader *h = map;
+	const CfgScreen *cscr;
+	const uint32_t *mid;
+	const uint32_t *bucket;
+	const CfgProvider *prov;
+	const char *str;
 
-	path = getpath(pmtpath);
-	for (char **ptr = (char**) &pmtpath; *ptr != NULL; ptr++) 
-		name = *ptr;
-
-	for (char **ptr = argv; *ptr != NULL; ptr++)
-		argc++;
+	if (len < sizeof(CacheHeader) || h->magic != CACHE_MAGIC || h->version != CACHE_VERSION)
+		return 0;
+	if (h->mtime != getmtime(st) || h->size != (uint64_t) st->st_size
+	    || h->ino != (uint64_t) st->st_ino || h->dev != (uint64_t) st->st_dev)
+		return 0;
+	if (!h->nstring || !h->nbucket || (h->nbucket & (h->nbucket - 1)))
+		return 0;
+	if (len != sizeof(CacheHeader) + (uint64_t) h->nscreen * sizeof(CfgScreen)
+	    + (uint64_t) h->nmonitor * (sizeof(CfgMonitor) + sizeof(uint32_t))
+	    + (uint64_t) h->nbucket * sizeof(uint32_t) + (uint64_t) h->nprovider * sizeof(CfgProvider) + h->nstring)
+		return 0;
 
-	args = malloc((argc + 2) * sizeof (char*));
-	if (!args)
-		dielog("malloc()");
+	cscr = (const CfgScreen*) (h + 1);
+	mid = (const uint32_t*) ((const CfgMonitor*) (cscr + h->nscreen) + h->nmonitor);
+	bucket = mid + h->nmonitor;
+	prov = (const CfgProvider*) (bucket + h->nbucket);
+	str = (const char*) (prov + h->nprovider);
 
-	args[0] = strdup(name);
-	for (size_t i = 0; i < argc; i++) {
-		args[i+1] = strdup(argv[i]);
+	if (str[h->nstring - 1] != '\0')
+		return 0;
+	for (uint32_t i = 0; i < h->nscreen; i++) {
+		if ((cscr[i].name != CFG_NONE && cscr[i].name >= h->nstring) || cscr[i].next > h->nscreen
+		    || (uint64_t) cscr[i].monitor + cscr[i].nmonitor > h->nmonitor)
+			return 0;
 	}
-	args[argc+1] = NULL;
-
-	option = -EREMOTEIO;
-	buffer[0] = '\0';
-
-	if (pipe(writepipe) < 0 || pipe(readpipe) < 0) {
-		logstring("Failed to initialize pipes");
-		return -ESTRPIPE;
+	for (uint32_t i = 0; i < h->nmonitor; i++) {
+		if (mid[i] != CFG_NONE && mid[i] >= h->nstring)
+			return 0;
+	}
+	for (uint32_t i = 0; i < h->nbucket; i++) {
+		if (bucket[i] > h->nscreen)
+			return 0;
+	}
+	for (uint32_t i = 0; i < h->nprovider; i++) {
+		if (prov[i].source >= h->nstring || prov[i].sink >= h->nstring)
+			return 0;
 	}
-	
-	switch (fork()) {
-		case -1:
-			logstring("fork() failed");
-			return -ECHILD;
 
-		case 0: /* child - prompt application */
-			close(writepipe[1]);
-			close(readpipe[0]);
+	return 1;
+}
 
-			dup2(writepipe[0], STDIN_FILENO);
-			close(writepipe[0]);
+/*
+ * returns 1 if the connected outputs are still driven as recorded the last
+ * time a layout was applied to them, from the same config
+ */
+static int
+checkstate(void)
+{
+	StateRecord r;
+	const SnapOutput *output;
+	const SnapCrtc *crtc;
+	const StateOutput *o;
+	uint64_t mtime;
+	uint64_t size;
+	size_t mc = 0;
+	size_t nlit = 0;
+	size_t j;
+	int ret;
 
-			dup2(readpipe[1], STDOUT_FILENO);
-			close(readpipe[1]);
-			
-			execv(path, args);
-			exit(EXIT_FAILURE);
+	if (!loadstate(getsignature(), &r))
+		return 0;
 
-		default: /* parent */
-			close(writepipe[0]);
-			close(readpipe[1]);
+	getcfgkey(&mtime, &size);
+	ret = r.mtime == mtime && r.size == size;
 
-			write(writepipe[1], menu, strlen(menu) + 1);
-			close(writepipe[1]);
+	for (size_t i = 0; i < snap.noutput; i++) {
+		if (snap.outputs[i].connection == RR_Connected)
+			mc++;
+	}
+	ret = ret && r.noutput == mc;
 
-			wait(NULL);
+	for (size_t i = 0; ret && i < r.noutput; i++) {
+		o = &r.outputs[i];
+		for (output = NULL, j = 0; j < snap.noutput; j++) {
+			if (snap.outputs[j].name && !strcmp(snap.outputs[j].name, o->name))
+				output = &snap.outputs[j];
+		}
 
-			read(readpipe[0], buffer, sizeof(buffer));
-			close(readpipe[0]);
+		ret = output && output->connection == RR_Connected && (crtc = getsnapcrtc(output->crtc))
+		      && crtc->mode == o->mode && crtc->x == o->x && crtc->y == o->y && crtc->rotation == o->rotation;
+		if (ret && !strcmp(r.primary, o->name))
+			ret = output->id == snap.primary;
 	}
-	ptr = strchr(buffer, '\t');
-	if (ptr != NULL)
-		sscanf(ptr, "%d", &option);
 
-	for (char **ptr = args; *ptr != NULL; ptr++)
-		if (*ptr)
-			free(*ptr);
-	free(args);
+	/* each output has a crtc of its own, any other lit crtc is turned off when applying */
+	for (size_t i = 0; ret && i < snap.ncrtc; i++) {
+		if (snap.crtcs[i].mode != None)
+			nlit++;
+	}
+	ret = ret && nlit == r.noutput;
+
+	if (ret) {
+		char log[LOG_SIZE];
+
+		snprintf(log, sizeof(log), "DEBUG - Layout %s is still applied, nothing to change",
+		         r.name[0] ? r.name : "(default)");
+		logstring(log);
+	}
+
+	freestate(&r);
+	return ret;
+}
+
+static void
+cleanup(CfgScreens *cs)
+{
+	freescreens(cs);
+	freesnapshot();
+	if (resources) {
+		XRRFreeScreenResources(resources);
+		resources = NULL;
+	}
+	if (dpy) {
+		XCloseDisplay(dpy);
+		dpy = NULL;
+	}
+}
+
+static void
+clearsnapcrtc(SnapCrtc *c)
+{
+	RRCrtc id = c->id;
+
+	free(c->outputs);
+	memset(c, 0, sizeof(SnapCrtc));
+	c->id = id;
+}
+
+static void
+clearsnapoutput(SnapOutput *o)
+{
+	RROutput id = o->id;
+
+	free(o->name);
+	free(o->crtcs);
+	free(o->modes);
+	free(o->sorted);
+	free(o->edid);
+	memset(o, 0, sizeof(SnapOutput));
+	o->id = id;
+	o->connection = RR_Disconnected;
+}
+
+/* closes the pipes of the prompt that are still open and reaps it */
+static void
+closeprompt(Prompt *p)
+{
+	if (p->in >= 0)
+		close(p->in);
+	if (p->out >= 0)
+		close(p->out);
+	p->in = p->out = -1;
+
+	while (waitpid(p->pid, NULL, 0) < 0 && errno == EINTR);
+	p->pid = -1;
+}
+
+/* returns 0 if the fingerprint is the configured one, which without the serial matches any */
+static int
+cmpedid(const char *key, const char *fp)
+{
+	if (!fp || !fp[0])
+		return 1;
+	return strlen(key) == 8 ? strncasecmp(key, fp, 8) : strcasecmp(key, fp);
+}
+
+static int
+cmpmodeid(const void *a, const void *b)
+{
+	const SnapMode *ma = a;
+	const SnapMode *mb = b;
+
+	return (ma->id > mb->id) - (ma->id < mb->id);
+}
+
+static int
+cmpmodesize(const void *a, const void *b)
+{
+	const SnapMode *ma = *(SnapMode* const*) a;
+	const SnapMode *mb = *(SnapMode* const*) b;
+
+	if (ma->width != mb->width)
+		return ma->width < mb->width ? 1 : -1;
+	if (ma->height != mb->height)
+		return ma->height < mb->height ? 1 : -1;
+	return (ma->rate < mb->rate) - (ma->rate > mb->rate);
+}
+
+/* returns 0 if both screens are configured the same, their strings included */
+static int
+cmpscreen(const CfgScreens *a, const CfgScreen *sa, const CfgScreens *b, const CfgScreen *sb)
+{
+	const char *x;
+	const char *y;
+
+	if (sa->sig != sb->sig || sa->dpi != sb->dpi || sa->nmonitor != sb->nmonitor)
+		return 1;
+	x = getstring(a, sa->name);
+	y = getstring(b, sb->name);
+	if (!x != !y || (x && strcmp(x, y)))
+		return 1;
+
+	for (size_t i = 0; i < sa->nmonitor; i++) {
+		if (memcmp(&a->m[sa->monitor + i], &b->m[sb->monitor + i], sizeof(CfgMonitor)))
+			return 1;
+		x = getstring(a, a->mid[sa->monitor + i]);
+		y = getstring(b, b->mid[sb->monitor + i]);
+		if (!x != !y || (x && strcmp(x, y)))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+cmpsize(const void *a, const void *b)
+{
+	size_t x = *(const size_t*) a;
+	size_t y = *(const size_t*) b;
+
+	return (x > y) - (x < y);
+}
+
+static int
+cmpstr(const void *a, const void *b)
+{
+	return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/* returns a connection to the control socket of a running daemon, or -1 */
+static int
+connectdaemon(void)
+{
+	struct sockaddr_un addr;
+	char *path;
+	int fd;
+
+	if (!(path = getsockpath()))
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
 	free(path);
 
-	return option;
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr*) &addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
 }
 
+/* counts a request the client waited for the reply of, in the current phase */
 static void
-logstring(const char *string)
+countroundtrip(void)
 {
-	if (!string)
+	if (curphase >= 0)
+		phases[curphase].roundtrips++;
+}
+
+static void
+dielog(const char *func)
+{
+	char log[LOG_SIZE];
+
+	sprintf(log, "ERROR - %s failed - %s", func, strerror(errno));
+	logstring(log);
+	exit(errno);
+}
+
+/*
+ * fills in the EDID fingerprint of every connected output without one.
+ * They are cached keyed on the output, its name and the config timestamp
+ * of the server, which changes with every hotplug, so each monitor is
+ * read once per connection instead of once per run. The displays share
+ * the cache, each rewrites only its own records.
+ */
+static void
+fetchedids(void)
+{
+	FILE *fp;
+	FILE *in;
+	SnapOutput *o;
+	char *path;
+	char *tmp;
+	char *line = NULL;
+	char display[BUF_SIZE];
+	char name[BUF_SIZE];
+	char key[32];
+	unsigned long id;
+	unsigned long epoch;
+	size_t cap = 0;
+	int missing = 0;
+	int lock;
+	int fail;
+
+	for (size_t i = 0; i < snap.noutput; i++) {
+		if (snap.outputs[i].connection == RR_Connected && !snap.outputs[i].edid)
+			missing = 1;
+	}
+	if (!missing)
+		return;
+
+	path = getpath(edidpath);
+	if ((fp = fopen(path, "r"))) {
+		while (getline(&line, &cap, fp) > 0) {
+			if (sscanf(line, "%511s %lx %lu %511s %31s", display, &id, &epoch, name, key) != 5
+			    || strcmp(display, DisplayString(dpy)) || epoch != resources->configTimestamp)
+				continue;
+			for (size_t i = 0; i < snap.noutput; i++) {
+				o = &snap.outputs[i];
+				if (o->connection != RR_Connected || o->edid || o->id != id || strcmp(o->name, name))
+					continue;
+				if (!(o->edid = strdup(strcmp(key, "-") ? key : "")))
+					dielog("strdup()");
+			}
+		}
+		fclose(fp);
+	}
+
+	missing = 0;
+	for (size_t i = 0; i < snap.noutput; i++) {
+		o = &snap.outputs[i];
+		if (o->connection == RR_Connected && !o->edid) {
+			o->edid = readedid(o);
+			missing = 1;
+		}
+	}
+
+	/* only the connected outputs are kept, the others get another timestamp once connected */
+	if (missing && !strpbrk(DisplayString(dpy), " \t\n")) {
+		tmp = gettmppath(path);
+		makedirs(tmp);
+		lock = lockpath(path);
+
+		if (!(fp = fopen(tmp, "w"))) {
+			fail = 1;
+		} else {
+			/* the records of the other displays are kept */
+			if ((in = fopen(path, "r"))) {
+				while (getline(&line, &cap, in) > 0) {
+					if (sscanf(line, "%511s %lx %lu %511s %31s", display, &id, &epoch, name, key) == 5
+					    && strcmp(display, DisplayString(dpy)))
+						fputs(line, fp);
+				}
+				fclose(in);
+			}
+			for (size_t i = 0; i < snap.noutput; i++) {
+				o = &snap.outputs[i];
+				if (o->edid && !strpbrk(o->name, " \t\n"))
+					fprintf(fp, "%s %lx %lu %s %s\n", DisplayString(dpy), (unsigned long) o->id,
+					        (unsigned long) resources->configTimestamp, o->name, o->edid[0] ? o->edid : "-");
+			}
+			fail = ferror(fp);
+			if (fclose(fp))
+				fail = 1;
+			if (fail || rename(tmp, path)) {
+				fail = 1;
+				unlink(tmp);
+			}
+		}
+
+		if (fail) {
+			char log[LOG_SIZE];
+
+			snprintf(log, sizeof(log), "WARN - Failed to write EDID cache: %s - %s", path, strerror(errno));
+			logstring(log);
+		}
+		if (lock >= 0)
+			close(lock);
+		free(tmp);
+	}
+
+	free(line);
+	free(path);
+}
+
+#ifdef XCB
+/*
+ * refetches every stale output and crtc and the primary output.
+ * All requests are sent before the first reply is read, so the whole
+ * snapshot costs about one round trip instead of one per output and crtc.
+ */
+static void
+fetchsnapshot(void)
+{
+	xcb_connection_t *c;
+	xcb_randr_get_output_info_cookie_t *ocookie;
+	xcb_randr_get_crtc_info_cookie_t *ccookie;
+	xcb_randr_get_output_primary_cookie_t pcookie;
+	xcb_randr_get_output_info_reply_t *oreply;
+	xcb_randr_get_crtc_info_reply_t *creply;
+	xcb_randr_get_output_primary_reply_t *preply;
+	SnapOutput *o;
+	SnapCrtc *cr;
+
+	c = XGetXCBConnection(dpy);
+
+	if (!(ocookie = malloc((snap.noutput + 1) * sizeof(xcb_randr_get_output_info_cookie_t))))
+		dielog("malloc()");
+	if (!(ccookie = malloc((snap.ncrtc + 1) * sizeof(xcb_randr_get_crtc_info_cookie_t))))
+		dielog("malloc()");
+
+	for (size_t i = 0; i < snap.noutput; i++) {
+		if (snap.outputs[i].stale)
+			ocookie[i] = xcb_randr_get_output_info(c, snap.outputs[i].id, resources->configTimestamp);
+	}
+	for (size_t i = 0; i < snap.ncrtc; i++) {
+		if (snap.crtcs[i].stale)
+			ccookie[i] = xcb_randr_get_crtc_info(c, snap.crtcs[i].id, resources->configTimestamp);
+	}
+	pcookie = xcb_randr_get_output_primary(c, root);
+	xcbrequest = pcookie.sequence;
+	countroundtrip();
+
+	for (size_t i = 0; i < snap.noutput; i++) {
+		if (!(o = &snap.outputs[i])->stale)
+			continue;
+
+		clearsnapoutput(o);
+		if (!(oreply = xcb_randr_get_output_info_reply(c, ocookie[i], NULL)))
+			continue;
+
+		o->connection = oreply->connection;
+		o->crtc       = oreply->crtc;
+		o->ncrtc      = oreply->num_crtcs;
+		o->nmode      = oreply->num_modes;
+		o->npreferred = oreply->num_preferred;
+
+		if (!(o->name = malloc(oreply->name_len + 1)))
+			dielog("malloc()");
+		if (!(o->crtcs = malloc((o->ncrtc + 1) * sizeof(RRCrtc))))
+			dielog("malloc()");
+		if (!(o->modes = malloc((o->nmode + 1) * sizeof(RRMode))))
+			dielog("malloc()");
+
+		memcpy(o->name, xcb_randr_get_output_info_name(oreply), oreply->name_len);
+		o->name[oreply->name_len] = '\0';
+		for (int j = 0; j < o->ncrtc; j++)
+			o->crtcs[j] = xcb_randr_get_output_info_crtcs(oreply)[j];
+		for (int j = 0; j < o->nmode; j++)
+			o->modes[j] = xcb_randr_get_output_info_modes(oreply)[j];
+
+		free(oreply);
+	}
+
+	for (size_t i = 0; i < snap.ncrtc; i++) {
+		if (!(cr = &snap.crtcs[i])->stale)
+			continue;
+
+		clearsnapcrtc(cr);
+		if (!(creply = xcb_randr_get_crtc_info_reply(c, ccookie[i], NULL)))
+			continue;
+
+		cr->timestamp = creply->timestamp;
+		cr->x         = creply->x;
+		cr->y         = creply->y;
+		cr->width     = creply->width;
+		cr->height    = creply->height;
+		cr->mode      = creply->mode;
+		cr->rotation  = creply->rotation;
+		cr->rotations = creply->rotations;
+		cr->noutput   = creply->num_outputs;
+
+		if (!(cr->outputs = malloc((cr->noutput + 1) * sizeof(RROutput))))
+			dielog("malloc()");
+		for (int j = 0; j < cr->noutput; j++)
+			cr->outputs[j] = xcb_randr_get_crtc_info_outputs(creply)[j];
+
+		free(creply);
+	}
+
+	if ((preply = xcb_randr_get_output_primary_reply(c, pcookie, NULL))) {
+		snap.primary = preply->output;
+		free(preply);
+	}
+
+	free(ocookie);
+	free(ccookie);
+}
+#else
+/* refetches every stale output and crtc and the primary output */
+static void
+fetchsnapshot(void)
+{
+	XRROutputInfo *oinfo;
+	XRRCrtcInfo *cinfo;
+	SnapOutput *o;
+	SnapCrtc *c;
+
+	for (size_t i = 0; i < snap.noutput; i++) {
+		if (!(o = &snap.outputs[i])->stale)
+			continue;
+
+		clearsnapoutput(o);
+		countroundtrip();
+		if (!(oinfo = XRRGetOutputInfo(dpy, resources, o->id)))
+			continue;
+
+		o->connection = oinfo->connection;
+		o->crtc       = oinfo->crtc;
+		o->ncrtc      = oinfo->ncrtc;
+		o->nmode      = oinfo->nmode;
+		o->npreferred = oinfo->npreferred;
+
+		if (!(o->name = strdup(oinfo->name)))
+			dielog("strdup()");
+		if (!(o->crtcs = malloc((oinfo->ncrtc + 1) * sizeof(RRCrtc))))
+			dielog("malloc()");
+		if (!(o->modes = malloc((oinfo->nmode + 1) * sizeof(RRMode))))
+			dielog("malloc()");
+		memcpy(o->crtcs, oinfo->crtcs, oinfo->ncrtc * sizeof(RRCrtc));
+		memcpy(o->modes, oinfo->modes, oinfo->nmode * sizeof(RRMode));
+
+		XRRFreeOutputInfo(oinfo);
+	}
+
+	for (size_t i = 0; i < snap.ncrtc; i++) {
+		if (!(c = &snap.crtcs[i])->stale)
+			continue;
+
+		clearsnapcrtc(c);
+		countroundtrip();
+		if (!(cinfo = XRRGetCrtcInfo(dpy, resources, c->id)))
+			continue;
+
+		c->timestamp = cinfo->timestamp;
+		c->x         = cinfo->x;
+		c->y         = cinfo->y;
+		c->width     = cinfo->width;
+		c->height    = cinfo->height;
+		c->mode      = cinfo->mode;
+		c->rotation  = cinfo->rotation;
+		c->rotations = cinfo->rotations;
+		c->noutput   = cinfo->noutput;
+
+		if (!(c->outputs = malloc((cinfo->noutput + 1) * sizeof(RROutput))))
+			dielog("malloc()");
+		memcpy(c->outputs, cinfo->outputs, cinfo->noutput * sizeof(RROutput));
+
+		XRRFreeCrtcInfo(cinfo);
+	}
+
+	snap.primary = XRRGetOutputPrimary(dpy, root);
+	countroundtrip();
+}
+#endif /* XCB */
+
+/* returns the name of the only connected output with the fingerprint, or NULL */
+static char*
+findedid(const char *key)
+{
+	char *name = NULL;
+
+	fetchedids();
+	for (size_t i = 0; i < snap.noutput; i++) {
+		if (snap.outputs[i].connection != RR_Connected || cmpedid(key, snap.outputs[i].edid))
+			continue;
+		if (name)
+			return NULL;
+		name = snap.outputs[i].name;
+	}
+
+	return name;
+}
+
+/*
+ * runs a process for every display of the comma separated list, and for
+ * every screen of a display given without one, so they are all probed and
+ * set up at once instead of one after another. Each has a connection, a
+ * snapshot and a config of its own, with $DISPLAY set to its display.
+ * Returns 0 in the process of a display, and 1 in the others once all of
+ * theirs exited, with status set to 1 if any of them failed.
+ */
+static int
+forkdisplays(char *list, int *status)
+{
+	Display *d;
+	pid_t *pid;
+	char log[LOG_SIZE];
+	char *name;
+	char *save;
+	char *screens;
+	size_t n = 1;
+	size_t len;
+	int count;
+	int wstatus;
+	pid_t ret;
+
+	for (const char *c = list; *c; c++)
+		n += *c == ',';
+	if (!(pid = malloc(n * sizeof(pid_t))))
+		dielog("malloc()");
+
+	/* the children would write what is buffered again */
+	logflush();
+
+	n = 0;
+	for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+		if ((pid[n] = fork()) < 0) {
+			snprintf(log, sizeof(log), "ERROR - fork() failed for display %s - %s", name, strerror(errno));
+			logstring(log);
+			*status = 1;
+			continue;
+		}
+		if (pid[n]) {
+			n++;
+			continue;
+		}
+
+		free(pid);
+		if (setenv("DISPLAY", name, 1) < 0)
+			dielog("setenv()");
+		dpyname = name;
+
+		/* counted on a connection of its own, each screen opens another */
+		if (!strchr(strrchr(name, ':') ? strrchr(name, ':') : name, '.') && (d = XOpenDisplay(name))) {
+			count = ScreenCount(d);
+			XCloseDisplay(d);
+			if (count > 1) {
+				len = strlen(name) + 12;
+				if (!(screens = malloc(count * len)))
+					dielog("malloc()");
+				screens[0] = '\0';
+				for (int i = 0; i < count; i++)
+					sprintf(screens + strlen(screens), "%s%s.%d", i ? "," : "", name, i);
+				/* dpyname points into screens in the process of each */
+				dpyname = NULL;
+				if (!forkdisplays(screens, status))
+					return 0;
+				free(screens);
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		while ((ret = waitpid(pid[i], &wstatus, 0)) < 0 && errno == EINTR)
+			;
+		if (ret < 0 || !WIFEXITED(wstatus) || WEXITSTATUS(wstatus))
+			*status = 1;
+	}
+
+	free(pid);
+	return 1;
+}
+
+static void
+freeconnected(char **id, size_t mc)
+{
+	for (size_t i = 0; i < mc; i++)
+		free(id[i]);
+	free(id);
+}
+
+/* frees the monitors of the layout, its strings belong to the config or the snapshot */
+static void
+freelayout(Layout *l)
+{
+	free(l->m);
+	l->m = NULL;
+	l->mc = 0;
+}
+
+static void
+freeplan(Plan *p)
+{
+	free(p->crtcs);
+	p->crtcs = NULL;
+	p->ncrtc = 0;
+}
+
+static void
+freescreens(CfgScreens *cs)
+{
+	if (!cs || cs->embedded)
 		return;
 
-	FILE *fp;
-	char *path;
-	time_t rawtime;
-	struct tm *timeinfo;
+	if (cs->map) {
+		munmap(cs->map, cs->maplen);
+	} else {
+		free(cs->s);
+		free(cs->m);
+		free(cs->mid);
+		free(cs->str);
+		free(cs->bucket);
+		free(cs->p);
+	}
+	free(cs);
+	cs = NULL;
+}
+
+static void
+freesnapshot(void)
+{
+	for (size_t i = 0; i < snap.noutput; i++) {
+		free(snap.outputs[i].name);
+		free(snap.outputs[i].crtcs);
+		free(snap.outputs[i].modes);
+		free(snap.outputs[i].sorted);
+		free(snap.outputs[i].edid);
+	}
+	for (size_t i = 0; i < snap.ncrtc; i++)
+		free(snap.crtcs[i].outputs);
+
+	free(snap.outputs);
+	free(snap.crtcs);
+	free(snap.modes);
+	memset(&snap, 0, sizeof(Snapshot));
+}
+
+static void
+freestate(StateRecord *r)
+{
+	free(r->outputs);
+	free(r->line);
+	memset(r, 0, sizeof(StateRecord));
+}
+
+/* reads the id of the running boot into buf, returns 1 without one */
+static int
+getbootid(char *buf, size_t size)
+{
+	FILE *fp;
+	int fail;
+
+	if (!(fp = fopen(bootidpath, "r")))
+		return 1;
+	fail = !fgets(buf, (int) size, fp);
+	fclose(fp);
+
+	if (!fail)
+		buf[strcspn(buf, "\n")] = '\0';
+	return fail || !buf[0] || strpbrk(buf, " \t");
+}
+
+/* gets the mtime in ns and the size of the config, both 0 without one */
+static void
+getcfgkey(uint64_t *mtime, uint64_t *size)
+{
+	struct stat st;
+	char *path;
+
+	path = getpath(cfgpath);
+	if (stat(path, &st)) {
+		*mtime = 0;
+#ifdef EMBED
+		*size = EMBED_KEY; /* the compiled in config changes with the binary */
+#else
+		*size = 0;
+#endif
+	} else {
+		*mtime = getmtime(&st);
+		*size = (uint64_t) st.st_size;
+	}
+	free(path);
+}
+
+/*
+ * returns the screens of the config. Given applied, a config that is not
+ * cached is first streamed through applyfirst(), and *applied is set if
+ * that applied a screen. Built with EMBED, the compiled in screens are
+ * returned as is when there is no config file.
+ */
+static CfgScreens*
+getcfgscreens(int *applied)
+{
+	FILE *fp;
+	CfgScreens *cs;
+	TomlArray *config = NULL;
+	struct stat st;
+#ifdef EMBED
+	char *path;
+	int missing;
+
+	/* a config file overrides the compiled in one */
+	path = getpath(cfgpath);
+	missing = access(path, F_OK);
+	free(path);
+	if (missing)
+		return &embedded;
+#endif
+
+	if (!(fp = getcfgstream()))
+		return NULL;
+
+	if (!fstat(fileno(fp), &st) && (cs = loadcache(&st))) {
+		fclose(fp);
+		return cs;
+	}
+	
+	config = tomlopen(fp, rootkeys);
+	fclose(fp);
+
+	if (!config) {
+		return NULL;
+	}
+
+	/* the rest of the config is still parsed afterwards, to cache it */
+	if (applied)
+		*applied = applyfirst(config);
+
+	if (tomlparse(config)) {
+		tomldeletearray(config);
+		return NULL;
+	}
+
+	cs = readscreens(config);
+	tomldeletearray(config);
+	savecache(cs, &st);
+	return cs;
+}
+
+static FILE*
+getcfgstream(void)
+{
+	FILE *fp;
+	char *path;
+
+	path = getpath(cfgpath);
+	if (access(path, F_OK)) {
+		char log[LOG_SIZE];
+
+		sprintf(log, "WARN - File: %s does not exist", path);
+		logstring(log);
+		free(path);
+		return NULL;
+	}
+
+	if (!(fp = fopen(path, "r"))) {
+		char log[LOG_SIZE];
+
+		sprintf(log, "ERROR - Failed to open file: %s - %s", path, strerror(errno));
+		logstring(log);
+		exit(errno);
+	}
+
+	free(path);
+	return fp;
+}
+
+/* returns the names of the connected outputs */
+static char**
+getconnected(size_t *mc)
+{
+	char **id;
+
+	if (!(id = malloc((snap.noutput + 1) * sizeof(char*))))
+		dielog("malloc()");
+	*mc = 0;
+
+	for (size_t i = 0; i < snap.noutput; i++) {
+		if (snap.outputs[i].connection == RR_Connected)
+			id[(*mc)++] = strdup(snap.outputs[i].name);
+	}
+
+	return id;
+}
+
+/*
+ * sends the matched screens to the running prompt and returns the position
+ * in match of the selected one, -1 without any or -2 if cancelled
+ */
+static int
+getinputscreen(const CfgScreens *cs, const size_t *match, size_t n, Prompt *p)
+{
+	char *out;
+	char *ptr;
+	int option = -1;
+
+	if (p->pid < 0)
+		return -2;
+
+	/* nothing to choose from, the default layout is applied instead */
+	if (n < 1) {
+		kill(p->pid, SIGTERM);
+		closeprompt(p);
+		return -1;
+	}
+
+	out = streamprompt(p, cs, match, n);
+	closeprompt(p);
+
+	if ((ptr = strchr(out, '\t')))
+		sscanf(ptr, "%d", &option);
+	free(out);
+
+	if (option < 0 || (size_t) option >= n)
+		return -2;
+
+	return option;
+}
+
+/* returns a monotonic timestamp in milliseconds */
+static long long
+getmsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t
+getmtime(const struct stat *st)
+{
+	return (uint64_t) st->st_mtim.tv_sec * 1000000000 + (uint64_t) st->st_mtim.tv_nsec;
+}
+
+static char*
+getpath(const char **arr)
+{
+	
+	char *path;
+	char *env;
+	size_t spath = 1;
+	
+	if (!(path = malloc(sizeof(char))))
+		dielog("malloc()");
+	path[0] = '\0';
+
+	for (int i = 0; arr[i] != NULL; i++) {
+		if (arr[i][0] == '$') {
+			if ((env = getenv(arr[i] + 1))) {
+				spath += strlen(env);
+				if(!(path = realloc(path, spath * sizeof(char))))
+					dielog("realloc()");
+				strcat(path, env);
+				continue;
+			}
+
+			for (size_t j = 0; !env && j < LENGTH(xdgdefaults); j++) {
+				if (strcmp(arr[i] + 1, xdgdefaults[j][0]))
+					continue;
+				if (!(env = getenv("HOME"))) {
+					fprintf(stderr, "ERROR - Failed to get env variable: HOME - %s\n", strerror(errno));
+					exit(errno);
+				}
+				spath += strlen(env) + strlen(xdgdefaults[j][1]);
+				if(!(path = realloc(path, spath * sizeof(char))))
+					dielog("realloc()");
+				strcat(path, env);
+				strcat(path, xdgdefaults[j][1]);
+			}
+			if (env)
+				continue;
+
+			fprintf(stderr, "ERROR - Failed to get env variable: %s - %s\n", arr[i], strerror(errno));
+			exit(errno);
+		} else {
+			spath += strlen(arr[i]) + 1;
+			if(!(path = realloc(path, spath * sizeof(char))))
+				dielog("realloc()");
+			strcat(path, "/");
+			strcat(path, arr[i]);
+		}
+	}
+
+	return path;
+}
+
+/*
+ * returns the position in match of the screen last selected for the
+ * connected outputs, or of the first one if it no longer matches
+ */
+static size_t
+getpinnedscreen(const CfgScreens *cs, const size_t *match, size_t n)
+{
+	StateRecord r;
+	const char *name;
+	size_t ret = 0;
+
+	if (n < 2 || !loadstate(getsignature(), &r))
+		return 0;
+
+	for (size_t i = 0; r.name[0] && i < n; i++) {
+		if ((name = getstring(cs, cs->s[match[i]].name)) && !strcmp(name, r.name)) {
+			ret = i;
+			break;
+		}
+	}
+
+	freestate(&r);
+	return ret;
+}
+
+/* returns the signature of the connected outputs */
+static uint64_t
+getsignature(void)
+{
+	char **id;
+	size_t mc;
+	uint64_t sig;
+
+	id = getconnected(&mc);
+	sig = signature(id, mc);
+	freeconnected(id, mc);
+	return sig;
+}
+
+static SnapCrtc*
+getsnapcrtc(RRCrtc id)
+{
+	for (size_t i = 0; i < snap.ncrtc; i++) {
+		if (snap.crtcs[i].id == id)
+			return &snap.crtcs[i];
+	}
+
+	return NULL;
+}
+
+static SnapMode*
+getsnapmode(RRMode id)
+{
+	SnapMode key;
+
+	key.id = id;
+	return bsearch(&key, snap.modes, snap.nmode, sizeof(SnapMode), cmpmodeid);
+}
+
+/* returns the path of the control socket, NULL without a runtime directory or if too long */
+static char*
+getsockpath(void)
+{
+	struct sockaddr_un addr;
+	char *path;
+
+	if (!getenv("XDG_RUNTIME_DIR"))
+		return NULL;
+
+	path = getpath(sockpath);
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		free(path);
+		return NULL;
+	}
+
+	return path;
+}
+
+static char*
+getstring(const CfgScreens *cs, uint32_t off)
+{
+	return off != CFG_NONE ? cs->str + off : NULL;
+}
+
+/*
+ * returns the path path is written aside to, unique to the process so
+ * displays set up at once do not clash
+ */
+static char*
+gettmppath(const char *path)
+{
+	char *tmp;
+
+	if (!(tmp = malloc(strlen(path) + sizeof(".4294967295.tmp"))))
+		dielog("malloc()");
+	sprintf(tmp, "%s.%u.tmp", path, (unsigned int) getpid());
+
+	return tmp;
+}
+
+/* returns a monotonic timestamp in microseconds */
+static long long
+getusec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* makes room for one more element, doubling the capacity when it is full */
+static void*
+grow(void *ptr, size_t n, size_t *cap, size_t size)
+{
+	if (n < *cap)
+		return ptr;
+
+	*cap = *cap ? *cap * 2 : 8;
+	if (!(ptr = realloc(ptr, *cap * size)))
+		dielog("realloc()");
+
+	return ptr;
+}
+
+/*
+ * builds the mode table of the resources, with the refresh rates computed
+ * once, and the list of modes of every output sorted for setupmonitor()
+ */
+static void
+indexmodes(void)
+{
+	XRRModeInfo *info;
+	SnapOutput *o;
+	SnapMode *mode;
+
+	free(snap.modes);
+	snap.nmode = resources->nmode;
+	if (!(snap.modes = malloc((snap.nmode + 1) * sizeof(SnapMode))))
+		dielog("malloc()");
+
+	for (size_t i = 0; i < snap.nmode; i++) {
+		info = &resources->modes[i];
+		snap.modes[i].id = info->id;
+		snap.modes[i].width = info->width;
+		snap.modes[i].height = info->height;
+		snap.modes[i].rate = (info->hTotal && info->vTotal)
+			? (double) info->dotClock / ((double) info->hTotal * (double) info->vTotal)
+			: 0.0;
+	}
+	qsort(snap.modes, snap.nmode, sizeof(SnapMode), cmpmodeid);
+
+	for (size_t i = 0; i < snap.noutput; i++) {
+		o = &snap.outputs[i];
+		free(o->sorted);
+		o->nsorted = 0;
+		if (!(o->sorted = malloc((o->nmode + 1) * sizeof(SnapMode*))))
+			dielog("malloc()");
+
+		for (int j = 0; j < o->nmode; j++) {
+			if ((mode = getsnapmode(o->modes[j])))
+				o->sorted[o->nsorted++] = mode;
+		}
+		qsort(o->sorted, o->nsorted, sizeof(SnapMode*), cmpmodesize);
+	}
+}
+
+/*
+ * hashes the monitor ids of every screen into buckets by their signature,
+ * each chain keeping the screens in config order
+ */
+static void
+indexscreens(CfgScreens *cs)
+{
+	char **id;
+	size_t b;
+
+	for (cs->nbucket = 16; cs->nbucket < 2 * cs->sc; cs->nbucket <<= 1);
+
+	if (!(cs->bucket = calloc(cs->nbucket, sizeof(uint32_t))))
+		dielog("calloc()");
+
+	for (size_t i = cs->sc; i-- > 0;) {
+		CfgScreen *s = &cs->s[i];
+
+		if (!(id = malloc((s->nmonitor + 1) * sizeof(char*))))
+			dielog("malloc()");
+		for (size_t j = 0; j < s->nmonitor; j++)
+			id[j] = cs->mid[s->monitor + j] != CFG_NONE ? getstring(cs, cs->mid[s->monitor + j]) : "";
+
+		s->sig = signature(id, s->nmonitor);
+		free(id);
+
+		/* the outputs of a fingerprint are only known once connected */
+		for (size_t j = 0; j < s->nmonitor; j++) {
+			if (cs->m[s->monitor + j].edid)
+				s->sig = SIG_EDID;
+		}
+
+		b = s->sig & (cs->nbucket - 1);
+		s->next = cs->bucket[b];
+		cs->bucket[b] = (uint32_t) i + 1;
+	}
+}
+
+static void
+initmonitor(LayoutMonitor *m)
+{
+	m->rid      = 0;
+	m->id       = NULL;
+	m->edid     = NULL;
+	m->primary  = 0;
+	m->xoffset  = 0;
+	m->yoffset  = 0;
+	m->xmode    = 0;
+	m->ymode    = 0;
+	m->rate     = 0.0;
+	m->tolerance = RATE_TOLERANCE;
+	m->rotation = RR_Rotate_0;
+}
+
+/*
+ * links the providers of the config, before the outputs are matched, as on
+ * hybrid graphics the outputs of a provider only appear once it is the sink
+ * of another. What was linked is recorded in the runtime directory, cleared
+ * every boot, with the display, the config and the config timestamp of the
+ * server, so the providers are only looked at again after a hotplug, a new
+ * server or config, and the links are only set if missing. The links are
+ * recorded too, so cs is only loaded when the config changed. Each display
+ * has a line of its own, the key followed by its links. Returns 1 if it set
+ * one, the outputs are then probed again.
+ */
+static int
+linkproviders(CfgScreens **cs)
+{
+	ProviderLink *links = NULL;
+	FILE *fp;
+	FILE *in;
+	char *path;
+	char *tmp;
+	char *line = NULL;
+	char *tab;
+	char *sink;
+	char *next;
+	char display[BUF_SIZE];
+	char boot[BUF_SIZE];
+	char cboot[BUF_SIZE];
+	size_t cap = 0;
+	size_t nlink = 0;
+	size_t caplink = 0;
+	uint64_t mtime;
+	uint64_t size;
+	unsigned long long cmtime;
+	unsigned long long csize;
+	unsigned long ts;
+	int cached = 0;
+	int set = 0;
+	int lock;
+	int fail;
+	int prev;
+
+	prev = setphase(PHASE_PROVIDER);
+	getcfgkey(&mtime, &size);
+
+	/* the links last until a reboot, outside the runtime directory the boot id tells them apart */
+	if (getbootid(boot, sizeof(boot)))
+		strcpy(boot, "-");
+	if (getenv("XDG_RUNTIME_DIR"))
+		path = getpath(providerpath);
+	else
+		path = strcmp(boot, "-") ? getpath(providercachepath) : NULL;
+
+	if (path && (fp = fopen(path, "r"))) {
+		while (!cached && getline(&line, &cap, fp) > 0) {
+			line[strcspn(line, "\n")] = '\0';
+			cached = sscanf(line, "%511s %511s %llu %llu %lu", display, cboot, &cmtime, &csize, &ts) == 5
+			         && !strcmp(display, DisplayString(dpy)) && !strcmp(cboot, boot)
+			         && cmtime == mtime && csize == size;
+		}
+		fclose(fp);
+
+		if (cached && ts == resources->configTimestamp) {
+			free(line);
+			free(path);
+			setphase(prev);
+			return 0;
+		}
+
+		/* the key is followed by a source and a sink per link, all tab separated */
+		for (tab = cached ? strchr(line, '\t') : NULL; tab; tab = next) {
+			if (!(sink = strchr(tab + 1, '\t')))
+				break;
+			*sink++ = '\0';
+			if ((next = strchr(sink, '\t')))
+				*next = '\0';
+
+			links = grow(links, nlink, &caplink, sizeof(ProviderLink));
+			if (!(links[nlink].source = strdup(tab + 1)) || !(links[nlink].sink = strdup(sink)))
+				dielog("strdup()");
+			nlink++;
+		}
+	}
+
+	if (!cached) {
+		if (!*cs) {
+			setphase(PHASE_CONFIG);
+			*cs = getcfgscreens(NULL);
+			setphase(PHASE_PROVIDER);
+		}
+		for (size_t i = 0; *cs && i < (*cs)->pc; i++) {
+			links = grow(links, nlink, &caplink, sizeof(ProviderLink));
+			if (!(links[nlink].source = strdup(getstring(*cs, (*cs)->p[i].source)))
+			    || !(links[nlink].sink = strdup(getstring(*cs, (*cs)->p[i].sink))))
+				dielog("strdup()");
+			nlink++;
+		}
+	}
+
+	if (nlink && (set = setproviders(links, nlink)))
+		probe(*cs, NULL, 0);
+
+	/* names with spaces cannot be recorded, they are looked at every run */
+	if (path && !strpbrk(DisplayString(dpy), " \t\n")) {
+		tmp = gettmppath(path);
+		makedirs(tmp);
+		lock = lockpath(path);
+
+		if ((fp = fopen(tmp, "w"))) {
+			/* the lines of the other displays are kept, those of earlier boots dropped */
+			if ((in = fopen(path, "r"))) {
+				while (getline(&line, &cap, in) > 0) {
+					if (sscanf(line, "%511s %511s %llu %llu %lu", display, cboot, &cmtime, &csize, &ts) == 5
+					    && strcmp(display, DisplayString(dpy)) && !strcmp(cboot, boot))
+						fputs(line, fp);
+				}
+				fclose(in);
+			}
+			fprintf(fp, "%s %s %llu %llu %lu", DisplayString(dpy), boot, (unsigned long long) mtime,
+			        (unsigned long long) size, (unsigned long) resources->configTimestamp);
+			for (size_t i = 0; i < nlink; i++) {
+				if (!strpbrk(links[i].source, "\t\n") && !strpbrk(links[i].sink, "\t\n"))
+					fprintf(fp, "\t%s\t%s", links[i].source, links[i].sink);
+			}
+			fputc('\n', fp);
+			fail = ferror(fp);
+			if (fclose(fp))
+				fail = 1;
+			if (fail || rename(tmp, path))
+				unlink(tmp);
+		}
+		if (lock >= 0)
+			close(lock);
+		free(tmp);
+	}
+
+	for (size_t i = 0; i < nlink; i++) {
+		free(links[i].source);
+		free(links[i].sink);
+	}
+	free(links);
+	free(line);
+	free(path);
+	setphase(prev);
+	return set;
+}
+
+/*
+ * listens on the control socket, see servecontrol(), and returns it, or -1
+ * if it cannot be created or another daemon is listening on it already
+ */
+static int
+listensocket(void)
+{
+	struct sockaddr_un addr;
+	char log[LOG_SIZE];
+	char *path;
+	int fd;
+
+	if (!(path = getsockpath())) {
+		logstring("WARN - XDG_RUNTIME_DIR is not set, the daemon has no control socket");
+		return -1;
+	}
+
+	if ((fd = connectdaemon()) >= 0) {
+		close(fd);
+		snprintf(log, sizeof(log), "WARN - Another daemon is listening on %s, this one has no control socket", path);
+		logstring(log);
+		free(path);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* left over by a daemon that did not exit cleanly */
+	unlink(path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+	    || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) || listen(fd, 8)) {
+		snprintf(log, sizeof(log), "WARN - Failed to listen on %s - %s", path, strerror(errno));
+		logstring(log);
+		if (fd >= 0)
+			close(fd);
+		free(path);
+		return -1;
+	}
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	free(path);
+	return fd;
+}
+
+/*
+ * returns the screens of the binary cache if it was built from the config
+ * described by st, NULL if it is missing, stale or damaged. The screens
+ * point straight into the mapped cache.
+ */
+static CfgScreens*
+loadcache(const struct stat *st)
+{
+	const CacheHeader *h;
+	CfgScreens *cs;
+	struct stat cst;
+	char *path;
+	void *map;
+	size_t len;
+	int fd;
+
+	path = getpath(cachepath);
+	fd = open(path, O_RDONLY);
+	free(path);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &cst) || cst.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
+
+	len = (size_t) cst.st_size;
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return NULL;
+	if (!checkcache(map, len, st)) {
+		munmap(map, len);
+		return NULL;
+	}
+
+	if (!(cs = calloc(1, sizeof(CfgScreens))))
+		dielog("calloc()");
+
+	h = map;
+	cs->map     = map;
+	cs->maplen  = len;
+	cs->sc      = h->nscreen;
+	cs->s       = (CfgScreen*) (h + 1);
+	cs->mc      = h->nmonitor;
+	cs->m       = (CfgMonitor*) (cs->s + cs->sc);
+	cs->mid     = (uint32_t*) (cs->m + cs->mc);
+	cs->nbucket = h->nbucket;
+	cs->bucket  = cs->mid + cs->mc;
+	cs->pc      = h->nprovider;
+	cs->p       = (CfgProvider*) (cs->bucket + cs->nbucket);
+	cs->nstr    = h->nstring;
+	cs->str     = (char*) (cs->p + cs->pc);
+
+	return cs;
+}
+
+/* fills the layout from the screen, its strings stay in the config */
+static void
+loadlayout(Layout *l, const CfgScreens *cs, const CfgScreen *s)
+{
+	char *name;
+
+	l->dpi = s->dpi;
+	l->name = getstring(cs, s->name);
+	l->mc = s->nmonitor;
+
+	if (!(l->m = malloc((l->mc + 1) * sizeof(LayoutMonitor))))
+		dielog("malloc()");
+
+	for (size_t i = 0; i < l->mc; i++) {
+		const CfgMonitor *m = &cs->m[s->monitor + i];
+		LayoutMonitor *lm = &l->m[i];
+
+		lm->rid       = 0;
+		lm->id        = getstring(cs, cs->mid[s->monitor + i]);
+		lm->edid      = NULL;
+		lm->rate      = m->rate;
+		lm->tolerance = m->tolerance;
+		lm->primary   = m->primary;
+		lm->xoffset   = m->xoffset;
+		lm->yoffset   = m->yoffset;
+		lm->xmode     = m->xmode;
+		lm->ymode     = m->ymode;
+		lm->rotation  = m->rotation;
+
+		/* left to the fingerprint if no output has it, so it is not found either */
+		if (m->edid && lm->id && (name = findedid(lm->id)))
+			lm->id = name;
+	}
+}
+
+/* finds the record of the signature on this screen in the state file, returns 1 if it was found */
+static int
+loadstate(uint64_t sig, StateRecord *r)
+{
+	FILE *fp;
+	char *path;
+	char *line = NULL;
+	char *field;
+	char *save;
+	size_t cap = 0;
+	uint64_t key;
+	int found = 0;
+
+	memset(r, 0, sizeof(StateRecord));
+	path = getpath(statepath);
+	fp = fopen(path, "r");
+	free(path);
+	if (!fp)
+		return 0;
+
+	key = statekey(sig);
+	while (getline(&line, &cap, fp) > 0) {
+		line[strcspn(line, "\n")] = '\0';
+		if (strtoull(line, NULL, 16) != key)
+			continue;
+
+		r->line = line;
+		r->sig = sig;
+		strtok_r(line, "\t", &save);
+		r->mtime = (field = strtok_r(NULL, "\t", &save)) ? strtoull(field, NULL, 10) : 0;
+		r->size = (field = strtok_r(NULL, "\t", &save)) ? strtoull(field, NULL, 10) : 0;
+		r->name = strtok_r(NULL, "\t", &save);
+		r->primary = strtok_r(NULL, "\t", &save);
+		if (!r->name || !r->primary)
+			break;
+
+		/* an empty field is marked by a single "-" */
+		if (!strcmp(r->name, "-"))
+			r->name[0] = '\0';
+		if (!strcmp(r->primary, "-"))
+			r->primary[0] = '\0';
+
+		while ((field = strtok_r(NULL, "\t", &save))) {
+			StateOutput *o;
+			char *name = field;
+			unsigned long mode;
+			unsigned int rotation;
+
+			if (!(field = strchr(field, ' ')))
+				break;
+			*field++ = '\0';
+
+			if (!(r->outputs = realloc(r->outputs, (r->noutput + 1) * sizeof(StateOutput))))
+				dielog("realloc()");
+			o = &r->outputs[r->noutput];
+			if (sscanf(field, "%d %d %lu %u", &o->x, &o->y, &mode, &rotation) != 4)
+				break;
+			o->name = name;
+			o->mode = (RRMode) mode;
+			o->rotation = (Rotation) rotation;
+			r->noutput++;
+		}
+
+		/* the connected set has one line, a malformed one is not looked past */
+		found = !field;
+		break;
+	}
+
+	fclose(fp);
+	if (!found) {
+		r->line = NULL;
+		free(line);
+		freestate(r);
+	}
+	return found;
+}
+
+/*
+ * waits for the lock of the file at path, so the records of the other
+ * displays are not lost when they rewrite it at once, and returns it.
+ * Closing it releases the lock, -1 means the file is written unlocked.
+ */
+static int
+lockpath(const char *path)
+{
+	struct flock fl;
+	char *lock;
+	int fd;
+
+	if (!(lock = malloc(strlen(path) + sizeof(".lock"))))
+		dielog("malloc()");
+	sprintf(lock, "%s.lock", path);
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	if ((fd = open(lock, O_WRONLY | O_CREAT | O_CLOEXEC, 0644)) >= 0) {
+		while (fcntl(fd, F_SETLKW, &fl) < 0) {
+			if (errno != EINTR) {
+				close(fd);
+				fd = -1;
+				break;
+			}
+		}
+	}
+
+	free(lock);
+	return fd;
+}
+
+/* logs every option of the last extraction that had an invalid value */
+static void
+logfields(const char *table, const TomlField *fields, size_t nfield)
+{
+	char log[LOG_SIZE];
+
+	for (size_t i = 0; i < nfield; i++) {
+		if (fields[i].status != 1)
+			continue;
+
+		snprintf(log, sizeof(log), "WARN - Invalid value for %s option: %s, keeping the default", table, fields[i].key);
+		logstring(log);
+	}
+}
+
+/*
+ * writes the buffered records to the log, which is opened once and kept
+ * open. If it cannot be opened they go to stderr, as a failing log must
+ * not stop a layout from being applied.
+ */
+static void
+logflush(void)
+{
+	char *path;
+
+	if (!loglen)
+		return;
+
+	if (logfd == -1) {
+		/* getpath() may exit, which flushes again */
+		logfd = -2;
+		path = getpath(logpath);
+		if ((logfd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+			fprintf(stderr, "ERROR - Failed to open in append mode, path: %s - %s\n", path, strerror(errno));
+			logfd = -2;
+		}
+		free(path);
+	}
+
+	writeall(logfd >= 0 ? logfd : STDERR_FILENO, logbuf, loglen);
+	loglen = 0;
+}
+
+static void
+logplan(const Plan *p)
+{
+	char log[LOG_SIZE * 8];
+	SnapMode *from;
+	SnapMode *to;
+	size_t len;
+
+	if (!p->ncrtc && !p->primary && !p->resize) {
+		logstring("DEBUG - Layout is already applied, nothing to change");
+		return;
+	}
+
+	len = snprintf(log, sizeof(log), "DEBUG - Applying layout changes:");
+
+	for (size_t i = 0; i < p->ncrtc && len < sizeof(log); i++) {
+		from = getsnapmode(p->crtcs[i].cur->mode);
+		len += snprintf(log + len, sizeof(log) - len, "\n\tcrtc %lu (%s): %ux%u@%.2lf+%d+%d %s -> ",
+		                (unsigned long) p->crtcs[i].cur->id, p->crtcs[i].output ? p->crtcs[i].output->name : "unused",
+		                from ? from->width : 0, from ? from->height : 0, from ? from->rate : 0.0,
+		                p->crtcs[i].cur->x, p->crtcs[i].cur->y, rotationname(p->crtcs[i].cur->rotation));
+		if (len >= sizeof(log))
+			break;
+
+		if (!p->crtcs[i].output) {
+			len += snprintf(log + len, sizeof(log) - len, "off");
+			continue;
+		}
+		to = getsnapmode(p->crtcs[i].mode);
+		len += snprintf(log + len, sizeof(log) - len, "%ux%u@%.2lf+%d+%d %s%s",
+		                to ? to->width : 0, to ? to->height : 0, to ? to->rate : 0.0,
+		                p->crtcs[i].x, p->crtcs[i].y, rotationname(p->crtcs[i].rotation),
+		                p->crtcs[i].disable ? " (off first)" : "");
+	}
+
+	if (p->primary && len < sizeof(log))
+		len += snprintf(log + len, sizeof(log) - len, "\n\tprimary: %s", p->primary->name);
+
+	if (p->resize && len < sizeof(log))
+		snprintf(log + len, sizeof(log) - len, "\n\tframebuffer: %dx%d (%dx%d mm) -> %ux%u (%ux%u mm)%s",
+		         p->cur.width, p->cur.height, p->cur.mwidth, p->cur.mheight,
+		         p->width, p->height, p->mmwidth, p->mmheight,
+		         p->ordered ? "" : " (grown and shrunk around the crtcs)");
+
+	logstring(log);
+}
+
+/*
+ * buffers a record until the next logflush(), which runs after each apply,
+ * before the daemon waits and on exit. The level is read from the prefix
+ * of the string, and records above the log level are dropped.
+ */
+static void
+logstring(const char *string)
+{
+	static time_t last = -1;
+	static char stamp[32];
+	struct tm tm;
+	time_t now;
+	size_t len;
+	int level = LOG_INFO;
+	int ret;
+
+	if (!string)
+		return;
+
+	for (size_t i = 0; i < LENGTH(loglevels); i++) {
+		len = strlen(loglevels[i]);
+		if (!strncmp(string, loglevels[i], len) && !strncmp(string + len, " - ", 3))
+			level = (int) i;
+	}
+	if (level > loglevel)
+		return;
+
+	/* formatted once per second */
+	time(&now);
+	if (now != last && localtime_r(&now, &tm)) {
+		strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+		last = now;
+	}
+
+	for (int retry = 0; retry < 2; retry++) {
+		ret = snprintf(logbuf + loglen, sizeof(logbuf) - loglen, "%s xrandr-setup%s%s\n%s\n\n", stamp,
+		               dpyname ? " " : "", dpyname ? dpyname : "", string);
+		if (ret >= 0 && (size_t) ret < sizeof(logbuf) - loglen) {
+			loglen += (size_t) ret;
+			return;
+		}
+		logflush();
+	}
+
+	/* longer than the whole buffer, truncated */
+	loglen = sizeof(logbuf) - 1;
+}
+
+/*
+ * prints what each phase cost since the last call to stderr, and with
+ * --timings json also logs it as one JSON object, then resets the phases
+ */
+static void
+logtimings(const char *run)
+{
+	char log[LOG_SIZE * 4];
+	Phase total = { 0, 0, 0, 0 };
+	const Phase *p;
+	size_t len;
+
+	if (!timings)
+		return;
+	setphase(-1);
+
+	fprintf(stderr, "xrandr-setup timings (%s%s%s)\n%-8s %10s %9s %12s\n", run, dpyname ? " on " : "",
+	        dpyname ? dpyname : "", "phase", "ms", "requests", "round trips");
+	len = snprintf(log, sizeof(log), "INFO - timings: {\"run\":\"%s\"", run);
+
+	for (size_t i = 0; i < PHASE_LAST; i++) {
+		p = &phases[i];
+		if (!p->runs)
+			continue;
+
+		fprintf(stderr, "%-8s %10.3f %9lu %12lu\n", phasenames[i], p->usec / 1000.0, p->requests, p->roundtrips);
+		if (len < sizeof(log))
+			len += snprintf(log + len, sizeof(log) - len, ",\"%s\":{\"us\":%lld,\"requests\":%lu,\"roundtrips\":%lu}",
+			                phasenames[i], p->usec, p->requests, p->roundtrips);
+		total.usec += p->usec;
+		total.requests += p->requests;
+		total.roundtrips += p->roundtrips;
+	}
+
+	fprintf(stderr, "%-8s %10.3f %9lu %12lu\n", "total", total.usec / 1000.0, total.requests, total.roundtrips);
+	if (len < sizeof(log))
+		snprintf(log + len, sizeof(log) - len, ",\"total\":{\"us\":%lld,\"requests\":%lu,\"roundtrips\":%lu}}",
+		         total.usec, total.requests, total.roundtrips);
+
+	if (timings > 1)
+		logstring(log);
+	memset(phases, 0, sizeof(phases));
+}
+
+/* creates the missing parent directories of path */
+static void
+makedirs(char *path)
+{
+	for (char *p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+
+		*p = '\0';
+		mkdir(path, 0755);
+		*p = '/';
+	}
+}
+
+/* returns 1 if the screen has exactly one monitor per connected output */
+static int
+matchscreen(const CfgScreens *cs, const CfgScreen *s, char **id, size_t mc)
+{
+	unsigned int match;
+	const char *mid;
+
+	if (s->nmonitor != mc)
+		return 0;
+
+	for (size_t j = 0; j < mc; j++) {
+		match = 0;
+		if (!(mid = getstring(cs, cs->mid[s->monitor + j])))
+			return 0;
+		if (cs->m[s->monitor + j].edid) {
+			if (!findedid(mid))
+				return 0;
+			continue;
+		}
+		for (size_t k = 0; k < mc; k++) {
+			if (!strcmp(mid, id[k]))
+				match++;
+		}
+		if (match != 1)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * returns the indices, in config order, of the screens matching the
+ * connected outputs, looked up by the signature of the connected set
+ */
+static size_t*
+matchscreens(const CfgScreens *cs, size_t *n)
+{
+	size_t *match;
+	size_t mc;
+	size_t nsig;
+	char **id;
+	uint64_t sig;
+
+	*n = 0;
+	if (!(match = malloc(((cs ? cs->sc : 0) + 1) * sizeof(size_t))))
+		dielog("malloc()");
+	if (!cs || !cs->sc)
+		return match;
+
+	id = getconnected(&mc);
+	sig = signature(id, mc);
+
+	/* the screens matched by fingerprint are in their own chain, merged back in config order */
+	for (size_t i = cs->bucket[sig & (cs->nbucket - 1)]; i; i = cs->s[i - 1].next) {
+		if (cs->s[i - 1].sig == sig && matchscreen(cs, &cs->s[i - 1], id, mc))
+			match[(*n)++] = i - 1;
+	}
+	if (sig != SIG_EDID) {
+		nsig = *n;
+		for (size_t i = cs->bucket[SIG_EDID & (cs->nbucket - 1)]; i; i = cs->s[i - 1].next) {
+			if (cs->s[i - 1].sig == SIG_EDID && matchscreen(cs, &cs->s[i - 1], id, mc))
+				match[(*n)++] = i - 1;
+		}
+		if (nsig && *n > nsig)
+			qsort(match, *n, sizeof(size_t), cmpsize);
+	}
+
+	freeconnected(id, mc);
+	return match;
+}
+
+/*
+ * compares the layout against the snapshot and plans only what differs.
+ * Every output of the layout gets a crtc of its own, and the lit crtcs
+ * left without one are turned off.
+ */
+static void
+newplan(Plan *p, const Layout *l)
+{
+	const SnapOutput **out;
+	const SnapOutput *output;
+	const SnapCrtc *crtc;
+	const LayoutMonitor **mon;
+	const LayoutMonitor *m;
+	PlanCrtc *pc;
+	unsigned int width;
+	unsigned int height;
+	char *used;
+	int *assigned;
+	size_t n = 0;
+	size_t j;
+	int diff;
+	double dpi;
+
+	memset(p, 0, sizeof(Plan));
+	if (!(p->crtcs = malloc((l->mc + snap.ncrtc + 1) * sizeof(PlanCrtc))))
+		dielog("malloc()");
+	if (!(out = malloc((l->mc + 1) * sizeof(SnapOutput*))))
+		dielog("malloc()");
+	if (!(mon = malloc((l->mc + 1) * sizeof(LayoutMonitor*))))
+		dielog("malloc()");
+	if (!(assigned = malloc((l->mc + 1) * sizeof(int))))
+		dielog("malloc()");
+	if (!(used = calloc(snap.ncrtc + 1, 1)))
+		dielog("calloc()");
+
+	for (size_t i = 0; i < snap.noutput; i++) {
+		output = &snap.outputs[i];
+		if (!output->name)
+			continue;
+		for (size_t j = 0; j < l->mc; j++) {
+			m = &l->m[j];
+			if (strcmp(m->id, output->name))
+				continue;
+
+			if (m->primary)
+				p->primary = output->id != snap.primary ? output : NULL;
+			out[n] = output;
+			mon[n++] = m;
+		}
+	}
+
+	assigncrtcs(out, n, assigned);
+
+	for (size_t i = 0; i < n; i++) {
+		if (assigned[i] < 0) {
+			char log[LOG_SIZE];
+
+			snprintf(log, sizeof(log), "WARN - No crtc is left to drive output %s", out[i]->name);
+			logstring(log);
+			continue;
+		}
+
+		crtc = &snap.crtcs[assigned[i]];
+		used[assigned[i]] = 1;
+		m = mon[i];
+		if (crtc->mode == m->rid && crtc->x == (int) m->xoffset && crtc->y == (int) m->yoffset
+		    && crtc->rotation == m->rotation && crtc->noutput == 1 && crtc->outputs[0] == out[i]->id)
+			continue;
+
+		/* a crtc that changes outputs is turned off first, so they are free to move */
+		pc = &p->crtcs[p->ncrtc++];
+		pc->cur = crtc;
+		pc->output = out[i];
+		pc->x = m->xoffset;
+		pc->y = m->yoffset;
+		pc->mode = m->rid;
+		pc->rotation = m->rotation;
+		pc->disable = crtc->mode != None && (crtc->noutput != 1 || crtc->outputs[0] != out[i]->id);
+	}
+
+	for (size_t i = 0; i < snap.ncrtc; i++) {
+		if (used[i] || snap.crtcs[i].mode == None)
+			continue;
+
+		pc = &p->crtcs[p->ncrtc++];
+		pc->cur = &snap.crtcs[i];
+		pc->output = NULL;
+		pc->x = 0;
+		pc->y = 0;
+		pc->mode = None;
+		pc->rotation = RR_Rotate_0;
+		pc->disable = 1;
+	}
+
+	free(out);
+	free(mon);
+	free(assigned);
+	free(used);
+
+	/* rotated monitors take their height horizontally */
+	for (size_t i = 0; i < l->mc ; i++) {
+		m = &l->m[i];
+		if (m->rotation == RR_Rotate_90 || m->rotation == RR_Rotate_270) {
+			width = m->ymode;
+			height = m->xmode;
+		} else {
+			width = m->xmode;
+			height = m->ymode;
+		}
+		if (m->yoffset + height > p->height)
+			p->height = m->yoffset + height;
+		if (m->xoffset + width > p->width)
+			p->width = m->xoffset + width;
+	}
+
+	/* as last reported by the server, XRRUpdateConfiguration() keeps it current in the daemon */
+	p->cur.width = DisplayWidth(dpy, DefaultScreen(dpy));
+	p->cur.height = DisplayHeight(dpy, DefaultScreen(dpy));
+	p->cur.mwidth = DisplayWidthMM(dpy, DefaultScreen(dpy));
+	p->cur.mheight = DisplayHeightMM(dpy, DefaultScreen(dpy));
+
+	if (l->dpi)
+		dpi = (double) l->dpi;
+	else
+		dpi = (25.4 * p->cur.height) / p->cur.mheight;
+
+	p->mmwidth  = (int) ((25.4 * p->width) / dpi);
+	p->mmheight = (int) ((25.4 * p->height) / dpi);
+
+	/* the physical size is derived, only a difference above rounding counts */
+	diff = (int) p->mmwidth - p->cur.mwidth;
+	p->resize = (int) p->width != p->cur.width || (int) p->height != p->cur.height || diff > 1 || diff < -1;
+	diff = (int) p->mmheight - p->cur.mheight;
+	p->resize = p->resize || diff > 1 || diff < -1;
+
+	/* every lit crtc must fit the framebuffer when it is resized */
+	p->ordered = 1;
+	for (size_t i = 0; p->resize && i < snap.ncrtc; i++) {
+		crtc = &snap.crtcs[i];
+		if (crtc->mode == None || (crtc->x + crtc->width <= p->width && crtc->y + crtc->height <= p->height))
+			continue;
+
+		for (pc = NULL, j = 0; j < p->ncrtc; j++) {
+			if (p->crtcs[j].cur == crtc)
+				pc = &p->crtcs[j];
+		}
+		if (pc)
+			pc->disable = 1;
+		else
+			p->ordered = 0;
+	}
+}
+
+/* fetches every output and crtc of the current resources */
+static void
+newsnapshot(void)
+{
+	freesnapshot();
+
+	snap.noutput = resources->noutput;
+	snap.ncrtc = resources->ncrtc;
+	if (!(snap.outputs = calloc(snap.noutput + 1, sizeof(SnapOutput))))
+		dielog("calloc()");
+	if (!(snap.crtcs = calloc(snap.ncrtc + 1, sizeof(SnapCrtc))))
+		dielog("calloc()");
+
+	for (size_t i = 0; i < snap.noutput; i++) {
+		snap.outputs[i].id = resources->outputs[i];
+		snap.outputs[i].stale = 1;
+	}
+	for (size_t i = 0; i < snap.ncrtc; i++) {
+		snap.crtcs[i].id = resources->crtcs[i];
+		snap.crtcs[i].stale = 1;
+	}
+
+	fetchsnapshot();
+	indexmodes();
+}
+
+static void
+parsemonitor(CfgScreens *cs, TomlArray *monitor)
+{
+	LayoutMonitor lm;
+	CfgMonitor *m;
+	size_t cap = cs->capmonitor;
+
+	initmonitor(&lm);
+
+	if (tomlextract(monitor, monitorfields, LENGTH(monitorfields), &lm))
+		logfields("monitor", monitorfields, LENGTH(monitorfields));
+
+	/* the ids grow along the monitors, so they share the capacity */
+	cs->m = grow(cs->m, cs->mc, &cs->capmonitor, sizeof(CfgMonitor));
+	cs->mid = grow(cs->mid, cs->mc, &cap, sizeof(uint32_t));
+
+	m = &cs->m[cs->mc];
+	m->rate      = lm.rate;
+	m->tolerance = lm.tolerance;
+	m->primary   = lm.primary;
+	m->xoffset   = lm.xoffset;
+	m->yoffset   = lm.yoffset;
+	m->xmode     = lm.xmode;
+	m->ymode     = lm.ymode;
+	m->rotation  = lm.rotation;
+	m->edid      = lm.edid != NULL;
+	m->pad       = 0;
+	if (lm.edid && lm.id) {
+		char log[LOG_SIZE];
+
+		snprintf(log, sizeof(log), "WARN - Monitor %.100s has an edid too, matching it by edid", lm.id);
+		logstring(log);
+	}
+	cs->mid[cs->mc++] = pushstring(cs, lm.edid ? lm.edid : lm.id);
+	cs->s[cs->sc - 1].nmonitor++;
+
+	free(lm.id);
+	free(lm.edid);
+}
+
+static void
+parseprovider(CfgScreens *cs, TomlArray *provider)
+{
+	ProviderLink pl = { NULL, NULL };
+
+	if (tomlextract(provider, providerfields, LENGTH(providerfields), &pl))
+		logfields("provider", providerfields, LENGTH(providerfields));
+
+	if (pl.source && pl.sink) {
+		cs->p = grow(cs->p, cs->pc, &cs->capprovider, sizeof(CfgProvider));
+		cs->p[cs->pc].source = pushstring(cs, pl.source);
+		cs->p[cs->pc++].sink = pushstring(cs, pl.sink);
+	} else {
+		logstring("WARN - Provider without a source or a sink, it is ignored");
+	}
+
+	free(pl.source);
+	free(pl.sink);
+}
+
+static void
+parsescreen(CfgScreens *cs, TomlArray *screen)
+{
+	TomlArrayKey *monitors = NULL;
+	Layout l = { 0, NULL, 0, NULL };
+	CfgScreen *s;
+
+	if (tomlextract(screen, screenfields, LENGTH(screenfields), &l))
+		logfields("screen", screenfields, LENGTH(screenfields));
+
+	cs->s = grow(cs->s, cs->sc, &cs->capscreen, sizeof(CfgScreen));
+	s = &cs->s[cs->sc++];
+	memset(s, 0, sizeof(CfgScreen));
+	s->name = pushstring(cs, l.name);
+	s->dpi = l.dpi;
+	s->monitor = (uint32_t) cs->mc;
+	free(l.name);
+
+	if (!(monitors = tomlgetarraykey(screen, "monitor")))
+		return;
+
+	for (size_t i = 0; i < monitors->narr; i++)
+		parsemonitor(cs, monitors->arr[i]);
+}
+
+static void
+printhelp(void)
+{
+	printf("xrandr-setup\nThis is an application for setting xRandR using premade configuration files for your screens\n");
+	printf("\nUsage:\n");
+	printf("\t'-h' or '--help'      prints this menu\n");
+	printf("\t'-p' or '--probe'     sets how outputs are probed: 'auto' (default), 'current' or 'full'\n");
+	printf("\t'-l' or '--log'       sets the most detailed level logged: 'error', 'warn', 'info' (default) or 'debug'\n");
+	printf("\t'-D' or '--displays'  sets up every display of the comma separated list at once, each screen of one without it\n");
+	printf("\t'-t' or '--timings'   prints the time and X requests of every phase to stderr ('json' also logs them)\n");
+	printf("\t'-a' or '--auto'      sets up with a basic screen ignoring the config files\n");
+	printf("\t'-s' or '--select'    prompts through the selected applications for a layout (the prompt args are passed through argv)\n");
+	printf("\t'-d' or '--daemon'    stays resident and applies the first matching layout on every output change\n");
+	printf("\t                      (an optional argument sets the quiet window in ms events are coalesced in, default %d)\n", DEBOUNCE_MS);
+	printf("\t'-c' or '--control'   sends a command to the daemon: 'list', 'apply <index|name>', 'auto', 'reload' or 'status'\n");
+}
+
+/*
+ * fetches the screen resources and the snapshot. The cached state of the
+ * server is tried first, as a full probe makes it poll every connector,
+ * and a full probe only follows if that state looks stale. With ids given
+ * only those outputs are refreshed after the cached probe.
+ */
+static void
+probe(const CfgScreens *cs, const RROutput *ids, size_t n)
+{
+	char log[LOG_SIZE];
+	long long start;
+	int prev;
+
+	prev = setphase(PHASE_PROBE);
+	if (probemode != PROBE_FULL) {
+		start = getmsec();
+		if (resources)
+			XRRFreeScreenResources(resources);
+		resources = XRRGetScreenResourcesCurrent(dpy, root);
+		countroundtrip();
+		if (ids)
+			refreshsnapshot(ids, n);
+		else
+			newsnapshot();
+
+		snprintf(log, sizeof(log), "DEBUG - Probed through XRRGetScreenResourcesCurrent in %lld ms",
+		         getmsec() - start);
+		logstring(log);
+
+		if (probemode == PROBE_CURRENT || !probestale(cs)) {
+			setphase(prev);
+			return;
+		}
+	}
+
+	start = getmsec();
+	if (resources)
+		XRRFreeScreenResources(resources);
+	resources = XRRGetScreenResources(dpy, root);
+	countroundtrip();
+	newsnapshot();
+	fullsig = getsignature();
+	fullprobed = 1;
+
+	snprintf(log, sizeof(log), "DEBUG - Probed through XRRGetScreenResources in %lld ms",
+	         getmsec() - start);
+	logstring(log);
+	setphase(prev);
+}
+
+/*
+ * returns 1 if the cached outputs need a full probe: a connected output
+ * has no modes yet, or nothing is connected or no configured layout
+ * matches while the connected set is not the one a full probe last saw
+ */
+static int
+probestale(const CfgScreens *cs)
+{
+	size_t *match;
+	size_t n = 0;
+	size_t mc = 0;
+
+	for (size_t i = 0; i < snap.noutput; i++) {
+		if (snap.outputs[i].connection == RR_Connected) {
+			if (!snap.outputs[i].nmode)
+				return 1;
+			mc++;
+		}
+	}
+
+	/* a full probe would only report the same set again, as after the daemon's own modesets */
+	if (fullprobed && getsignature() == fullsig)
+		return 0;
+	if (!mc)
+		return 1;
+	if (!cs || !cs->sc)
+		return 0;
+
+	match = matchscreens(cs, &n);
+	free(match);
+
+	return !n;
+}
+
+/* appends str to the string pool, returns its offset or CFG_NONE for NULL */
+static uint32_t
+pushstring(CfgScreens *cs, const char *str)
+{
+	size_t len;
+	uint32_t ret;
+
+	if (!str)
+		return CFG_NONE;
+
+	len = strlen(str) + 1;
+	if (cs->nstr + len > cs->capstr) {
+		while (cs->nstr + len > cs->capstr)
+			cs->capstr = cs->capstr ? cs->capstr * 2 : BUF_SIZE;
+		if (!(cs->str = realloc(cs->str, cs->capstr)))
+			dielog("realloc()");
+	}
+
+	ret = (uint32_t) cs->nstr;
+	memcpy(cs->str + cs->nstr, str, len);
+	cs->nstr += len;
+	return ret;
+}
+
+/*
+ * reads the fingerprint of the output, "VVV-PPPP-SSSSSSSS" from the vendor,
+ * product and serial in bytes 8 to 15 of its EDID, which are all that is
+ * requested of it. Empty without an EDID.
+ */
+static char*
+readedid(const SnapOutput *o)
+{
+	static Atom atom = None;
+	static int interned = 0;
+	unsigned char *prop = NULL;
+	unsigned long n;
+	unsigned long after;
+	unsigned int vendor;
+	Atom type;
+	int format;
+	char fp[32] = "";
+	char log[LOG_SIZE];
+	char *ret;
+
+	if (!interned) {
+		countroundtrip();
+		atom = XInternAtom(dpy, "EDID", True);
+		interned = 1;
+	}
+
+	/* the offset and length are in 32 bit units */
+	if (atom != None) {
+		countroundtrip();
+		if (XRRGetOutputProperty(dpy, o->id, atom, 2, 2, False, False, AnyPropertyType,
+		                         &type, &format, &n, &after, &prop) == Success && prop && format == 8 && n >= 8) {
+			vendor = (unsigned int) prop[0] << 8 | prop[1];
+			snprintf(fp, sizeof(fp), "%c%c%c-%04X-%08lX", '@' + (vendor >> 10 & 31), '@' + (vendor >> 5 & 31),
+			         '@' + (vendor & 31), (unsigned int) prop[2] | (unsigned int) prop[3] << 8,
+			         (unsigned long) prop[4] | (unsigned long) prop[5] << 8
+			         | (unsigned long) prop[6] << 16 | (unsigned long) prop[7] << 24);
+		}
+		if (prop)
+			XFree(prop);
+	}
+
+	snprintf(log, sizeof(log), "DEBUG - EDID of %.100s: %s", o->name, fp[0] ? fp : "none");
+	logstring(log);
+	if (!(ret = strdup(fp)))
+		dielog("strdup()");
+	return ret;
+}
+
+/* reads what the client sent so far into cmd, returns 1 once the command is complete */
+static int
+readcontrol(int fd, char *cmd, size_t *len)
+{
+	ssize_t ret;
+
+	/* poll() found it readable, so this does not block */
+	if ((ret = read(fd, cmd + *len, BUF_SIZE - 1 - *len)) < 0 && errno == EINTR)
+		return 0;
+	if (ret > 0)
+		*len += (size_t) ret;
+	if (ret > 0 && *len < BUF_SIZE - 1 && !memchr(cmd, '\n', *len))
+		return 0;
+
+	cmd[*len] = '\0';
+	cmd[strcspn(cmd, "\r\n")] = '\0';
+	return 1;
+}
+
+/* builds the flat screens of a parsed config and their index, config is left to the caller */
+static CfgScreens*
+readscreens(TomlArray *config)
+{
+	CfgScreens *cs;
+	TomlArrayKey *screens;
+	TomlArrayKey *providers;
+
+	if (!(cs = calloc(1, sizeof(CfgScreens))))
+		dielog("calloc()");
+
+	/* the pool starts with an empty string, so it is never empty */
+	pushstring(cs, "");
+
+	if ((providers = tomlgetarraykey(config, "provider"))) {
+		tomlresolve(config, providerfields, LENGTH(providerfields));
+		for (size_t i = 0; i < providers->narr; i++)
+			parseprovider(cs, providers->arr[i]);
+	}
+
+	if (!(screens = tomlgetarraykey(config, "screen")))
+		return cs;
+
+	tomlresolve(config, monitorfields, LENGTH(monitorfields));
+	tomlresolve(config, screenfields, LENGTH(screenfields));
+
+	for (size_t i = 0; i < screens->narr; i++)
+		parsescreen(cs, screens->arr[i]);
+
+	indexscreens(cs);
+	return cs;
+}
+
+/*
+ * drains the pending events of the config watch, returns 1 if one of them
+ * wrote the config file or renamed another file over it
+ */
+static int
+readwatch(int fd, const char *name)
+{
+	union {
+		char buf[4096];
+		struct inotify_event ev;
+	} u;
+	const struct inotify_event *ev;
+	ssize_t len;
+	int hit = 0;
+
+	while ((len = read(fd, u.buf, sizeof(u.buf))) > 0) {
+		for (char *p = u.buf; p < u.buf + len; p += sizeof(struct inotify_event) + ev->len) {
+			ev = (const struct inotify_event*) p;
+			if ((ev->mask & IN_Q_OVERFLOW) || (ev->len && !strcmp(ev->name, name)))
+				hit = 1;
+		}
+	}
+
+	return hit;
+}
+
+/*
+ * refetches only the given outputs and the crtcs they were or are driven by,
+ * unless the resources now list different outputs or crtcs than the snapshot
+ */
+static void
+refreshsnapshot(const RROutput *ids, size_t n)
+{
+	SnapOutput *o;
+	SnapCrtc *c;
+	RRCrtc *old;
+	int again = 0;
+
+	if (snap.noutput != (size_t) resources->noutput || snap.ncrtc != (size_t) resources->ncrtc) {
+		newsnapshot();
+		return;
+	}
+	for (size_t i = 0; i < snap.noutput; i++) {
+		if (snap.outputs[i].id != resources->outputs[i]) {
+			newsnapshot();
+			return;
+		}
+	}
+	for (size_t i = 0; i < snap.ncrtc; i++) {
+		if (snap.crtcs[i].id != resources->crtcs[i]) {
+			newsnapshot();
+			return;
+		}
+	}
+
+	if (!(old = calloc(snap.noutput + 1, sizeof(RRCrtc))))
+		dielog("calloc()");
+
+	for (size_t i = 0; i < snap.noutput; i++) {
+		o = &snap.outputs[i];
+		old[i] = o->crtc;
+		for (size_t j = 0; j < n; j++) {
+			if (o->id != ids[j])
+				continue;
+			o->stale = 1;
+			if ((c = getsnapcrtc(o->crtc)))
+				c->stale = 1;
+		}
+	}
+	fetchsnapshot();
+
+	/* outputs that moved to another crtc need that one refetched too */
+	for (size_t i = 0; i < snap.noutput; i++) {
+		o = &snap.outputs[i];
+		if (o->crtc && o->crtc != old[i] && (c = getsnapcrtc(o->crtc))) {
+			c->stale = 1;
+			again = 1;
+		}
+	}
+	if (again)
+		fetchsnapshot();
+
+	free(old);
+	indexmodes();
+}
+
+/*
+ * loads the config again, cs is kept while the new one is parsed and if it
+ * fails to. Only the screens in the bucket of the connected outputs are
+ * compared, and the default layout is applied again only if they changed.
+ * Returns 1 if the config failed to load.
+ */
+static int
+reloadscreens(CfgScreens **cs)
+{
+	CfgScreens *new;
+	char log[LOG_SIZE];
+	size_t *prevmatch;
+	size_t *match;
+	size_t prevn;
+	size_t n;
+	size_t nold = *cs ? (*cs)->sc : 0;
+	size_t changed = 0;
+	int same;
+	int prev;
+
+	prev = setphase(PHASE_CONFIG);
+	new = getcfgscreens(NULL);
+	setphase(prev);
+	if (!new) {
+		logstring("WARN - Failed to reload the configuration, the previous one is kept");
+		return 1;
+	}
+
+	/* for the log, screens are compared by position */
+	for (size_t i = 0; i < new->sc; i++) {
+		if (i >= nold || cmpscreen(*cs, &(*cs)->s[i], new, &new->s[i]))
+			changed++;
+	}
+	if (nold > new->sc)
+		changed += nold - new->sc;
+
+	prev = setphase(PHASE_MATCH);
+	prevmatch = matchscreens(*cs, &prevn);
+	match = matchscreens(new, &n);
+	setphase(prev);
+
+	same = (n == prevn);
+	for (size_t i = 0; same && i < n; i++)
+		same = !cmpscreen(*cs, &(*cs)->s[prevmatch[i]], new, &new->s[match[i]]);
+	free(prevmatch);
+	free(match);
+
+	freescreens(*cs);
+	*cs = new;
+
+	snprintf(log, sizeof(log), "INFO - Configuration reloaded with %zu changed screens, %s", changed,
+	         same ? "the matching layouts did not change" : "applying the matching layout");
+	logstring(log);
+	if (!same)
+		applydefault(new);
+	return 0;
+}
+
+/* restores every crtc of the plan, the framebuffer and the primary output from the snapshot */
+static void
+rollbackplan(const Plan *p)
+{
+	const SnapCrtc *c;
+
+	for (size_t i = 0; i < p->ncrtc; i++)
+		setcrtc(p->crtcs[i].cur, CurrentTime, 0, 0, None, RR_Rotate_0, NULL, 0);
+
+	if (p->resize)
+		XRRSetScreenSize(dpy, root, p->cur.width, p->cur.height, p->cur.mwidth, p->cur.mheight);
+
+	for (size_t i = 0; i < p->ncrtc; i++) {
+		c = p->crtcs[i].cur;
+		if (c->mode != None)
+			setcrtc(c, CurrentTime, c->x, c->y, c->mode, c->rotation, c->outputs, c->noutput);
+	}
+
+	if (p->primary)
+		XRRSetOutputPrimary(dpy, root, snap.primary);
+}
+
+static const char*
+rotationname(Rotation rotation)
+{
+	switch (rotation & 0xf) {
+		case RR_Rotate_90:
+			return "right";
+		case RR_Rotate_180:
+			return "inverted";
+		case RR_Rotate_270:
+			return "left";
+		default:
+			return "normal";
+	}
+}
+
+/*
+ * runs --select, --auto or --control through the daemon listening on fd.
+ * The menu gets the layouts the daemon lists, from its own snapshot and
+ * config, and the selected one is applied by it. Returns the exit status.
+ */
+static int
+runclient(int fd, char *argv[], const char *command)
+{
+	CfgScreens *cs;
+	Prompt pmt = { -1, -1, -1 };
+	char cmd[BUF_SIZE];
+	char *reply;
+	char *line;
+	char *tab;
+	char *end;
+	size_t *match;
+	int selscreen;
+	int ret;
+
+	if (command) {
+		reply = senddaemon(fd, command);
+	} else if (!argv) {
+		reply = senddaemon(fd, "auto");
+	} else {
+		/* the menu starts up while the daemon lists the layouts */
+		spawnprompt(&pmt, argv);
+		reply = senddaemon(fd, "list");
+
+		if (!(cs = calloc(1, sizeof(CfgScreens))))
+			dielog("calloc()");
+		pushstring(cs, "");
+
+		/* only the names of the listed screens are used */
+		for (line = reply; *line; line = end) {
+			if (!(end = strchr(line, '\n')))
+				end = line + strlen(line);
+			else
+				*end++ = '\0';
+			if (!(tab = strchr(line, '\t')))
+				continue;
+			*tab = '\0';
+
+			cs->s = grow(cs->s, cs->sc, &cs->capscreen, sizeof(CfgScreen));
+			memset(&cs->s[cs->sc], 0, sizeof(CfgScreen));
+			cs->s[cs->sc++].name = pushstring(cs, line);
+		}
+		free(reply);
+
+		if (!(match = malloc((cs->sc + 1) * sizeof(size_t))))
+			dielog("malloc()");
+		for (size_t i = 0; i < cs->sc; i++)
+			match[i] = i;
+
+		selscreen = getinputscreen(cs, match, cs->sc, &pmt);
+		free(match);
+		freescreens(cs);
+		close(fd);
+
+		if (selscreen == -2)
+			return 0;
+
+		if (selscreen == -1)
+			snprintf(cmd, sizeof(cmd), "auto");
+		else
+			snprintf(cmd, sizeof(cmd), "apply %d", selscreen);
+		if ((fd = connectdaemon()) < 0) {
+			fprintf(stderr, "xrandr-setup - the daemon stopped listening\n");
+			return 1;
+		}
+		reply = senddaemon(fd, cmd);
+	}
+	close(fd);
+
+	ret = !strncmp(reply, "ERROR", 5);
+	if (command || ret)
+		fputs(reply, ret ? stderr : stdout);
+	free(reply);
+	return ret;
+}
+
+/*
+ * keeps the display and the parsed config alive, reapplying on output changes.
+ * Output events arrive in bursts while a dock enumerates or a dGPU wakes up,
+ * so they are folded together until none arrived for the debounce window, and
+ * only that final state is matched and applied. Saves of the config file are
+ * debounced the same way before it is reloaded.
+ */
+static void
+rundaemon(CfgScreens *cs)
+{
+	XEvent ev;
+	struct pollfd pfd[4];
+	char cfgname[NAME_MAX + 1];
+	char cmd[BUF_SIZE];
+	char **id;
+	char **previd;
+	RROutput *dirty;
+	size_t mc;
+	size_t prevmc;
+	size_t ndirty = 0;
+	size_t nevents = 0;
+	size_t cmdlen = 0;
+	long long deadline = 0;
+	long long reloadat = 0;
+	long long cmdat = 0;
+	long long now;
+	int timeout;
+	int evbase;
+	int errbase;
+	int changed;
+	int reload;
+	int ready = 0;
+	int ctl;
+	int watch;
+
+	/* the rest of the connection setup, between runs nothing is timed */
+	setphase(PHASE_CONNECT);
+	countroundtrip();
+	if (!XRRQueryExtension(dpy, &evbase, &errbase)) {
+		logstring("ERROR - XRandR extension is not available");
+		exit(EXIT_FAILURE);
+	}
+
+	XRRSelectInput(dpy, root, RRScreenChangeNotifyMask | RROutputChangeNotifyMask);
+	setphase(-1);
+	if (!(dirty = malloc((snap.noutput + 1) * sizeof(RROutput))))
+		dielog("malloc()");
+	previd = getconnected(&prevmc);
+	applydefault(cs);
+	logtimings("daemon");
+
+	/* a client that hangs up before its reply fails the write instead of killing us */
+	signal(SIGPIPE, SIG_IGN);
+
+	/* poll() skips the fds left at -1 */
+	ctl = listensocket();
+	watch = watchconfig(cfgname, sizeof(cfgname));
+	pfd[0].fd = ConnectionNumber(dpy);
+	pfd[1].fd = ctl;
+	pfd[2].fd = watch;
+	pfd[3].fd = -1; /* the client whose command is being read */
+	for (size_t i = 0; i < LENGTH(pfd); i++) {
+		pfd[i].events = POLLIN;
+		pfd[i].revents = 0;
+	}
+
+	for (;;) {
+		while (XPending(dpy)) {
+			XNextEvent(dpy, &ev);
+
+			if (ev.type == evbase + RRScreenChangeNotify) {
+				XRRUpdateConfiguration(&ev);
+				continue;
+			}
+			if (ev.type != evbase + RRNotify || ((XRRNotifyEvent*) &ev)->subtype != RRNotify_OutputChange)
+				continue;
+
+			nevents++;
+			deadline = getmsec() + debounce;
+
+			/* remember each changed output once, to refresh only those */
+			RROutput out = ((XRROutputChangeNotifyEvent*) &ev)->output;
+			size_t i;
+
+			for (i = 0; i < ndirty && dirty[i] != out; i++);
+			if (i == ndirty && ndirty < snap.noutput)
+				dirty[ndirty++] = out;
+		}
+
+		if (pfd[2].revents & POLLIN) {
+			pfd[2].revents = 0;
+			if (readwatch(watch, cfgname))
+				reloadat = getmsec() + debounce;
+			continue;
+		}
+
+		/* one client at a time, the others wait in the backlog until it is served */
+		if (pfd[1].revents & POLLIN) {
+			pfd[1].revents = 0;
+			if ((pfd[3].fd = accept(ctl, NULL, NULL)) >= 0) {
+				pfd[1].fd = -1;
+				cmdlen = 0;
+				cmdat = getmsec() + CONTROL_TIMEOUT;
+			}
+			continue;
+		}
+
+		/* the command is read as it comes in, a client that does not send it in time is dropped */
+		if (pfd[3].revents) {
+			pfd[3].revents = 0;
+			ready = ready || readcontrol(pfd[3].fd, cmd, &cmdlen);
+		}
+		now = getmsec();
+		if (pfd[3].fd >= 0 && !ready && now >= cmdat) {
+			close(pfd[3].fd);
+			pfd[3].fd = -1;
+			pfd[1].fd = ctl;
+		}
+
+		/* commands and reloads see the outputs changed so far, even within the debounce window */
+		reload = reloadat && now >= reloadat;
+		if (reload || ready) {
+			if (ndirty) {
+				probe(cs, dirty, ndirty);
+				if (!(dirty = realloc(dirty, (snap.noutput + 1) * sizeof(RROutput))))
+					dielog("realloc()");
+				ndirty = 0;
+			}
+			if (reload) {
+				reloadat = 0;
+				reloadscreens(&cs);
+				logtimings("reload");
+			} else {
+				servecontrol(pfd[3].fd, cmd, &cs);
+				pfd[3].fd = -1;
+				pfd[1].fd = ctl;
+				ready = 0;
+			}
+			continue;
+		}
+
+		if (!nevents || now < deadline) {
+			timeout = nevents ? (int) (deadline - now) : -1;
+			if (reloadat && (timeout < 0 || reloadat - now < timeout))
+				timeout = (int) (reloadat - now);
+			if (pfd[3].fd >= 0 && (timeout < 0 || cmdat - now < timeout))
+				timeout = (int) (cmdat - now);
+			if (timeout < 0)
+				logflush();
+			poll(pfd, LENGTH(pfd), timeout);
+			continue;
+		}
+
+		probe(cs, dirty, ndirty);
+		if (!(dirty = realloc(dirty, (snap.noutput + 1) * sizeof(RROutput))))
+			dielog("realloc()");
+		ndirty = 0;
+
+		/* our own modesets also notify, only a new connected set is a hotplug */
+		id = getconnected(&mc);
+		changed = (mc != prevmc);
+		for (size_t i = 0; !changed && i < mc; i++)
+			changed = strcmp(id[i], previd[i]);
+
+		freeconnected(previd, prevmc);
+		previd = id;
+		prevmc = mc;
+
+		if (changed) {
+			char log[LOG_SIZE];
+
+			snprintf(log, sizeof(log), "INFO - Connected outputs changed, %zu output events coalesced", nevents);
+			logstring(log);
+			applydefault(cs);
+			logtimings("hotplug");
+		} else if (timings) {
+			/* the probe of our own modeset is not part of a hotplug */
+			memset(phases, 0, sizeof(phases));
+		}
+		nevents = 0;
+	}
+}
+
+/* writes the screens to the binary cache, keyed on the config described by st */
+static void
+savecache(const CfgScreens *cs, const struct stat *st)
+{
+	CacheHeader h;
+	char *path;
+	char *tmp;
+	char log[LOG_SIZE];
+	int fd;
+	int fail = 1;
+
+	if (!cs->nbucket || cs->sc >= CFG_NONE || cs->mc >= CFG_NONE || cs->pc >= CFG_NONE || cs->nstr >= CFG_NONE)
+		return;
+
+	memset(&h, 0, sizeof(h));
+	h.magic    = CACHE_MAGIC;
+	h.version  = CACHE_VERSION;
+	h.mtime    = getmtime(st);
+	h.size     = (uint64_t) st->st_size;
+	h.ino      = (uint64_t) st->st_ino;
+	h.dev      = (uint64_t) st->st_dev;
+	h.nscreen  = (uint32_t) cs->sc;
+	h.nmonitor = (uint32_t) cs->mc;
+	h.nbucket  = (uint32_t) cs->nbucket;
+	h.nstring  = (uint32_t) cs->nstr;
+	h.nprovider = (uint32_t) cs->pc;
+
+	path = getpath(cachepath);
+	tmp = gettmppath(path);
+	makedirs(tmp);
+
+	/* written aside and renamed, so readers never map a partial cache */
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+		fail = writeall(fd, &h, sizeof(h))
+		       || writeall(fd, cs->s, cs->sc * sizeof(CfgScreen))
+		       || writeall(fd, cs->m, cs->mc * sizeof(CfgMonitor))
+		       || writeall(fd, cs->mid, cs->mc * sizeof(uint32_t))
+		       || writeall(fd, cs->bucket, cs->nbucket * sizeof(uint32_t))
+		       || writeall(fd, cs->p, cs->pc * sizeof(CfgProvider))
+		       || writeall(fd, cs->str, cs->nstr);
+		if (close(fd))
+			fail = 1;
+		if (fail || rename(tmp, path)) {
+			fail = 1;
+			unlink(tmp);
+		}
+	}
+
+	if (fail) {
+		snprintf(log, sizeof(log), "WARN - Failed to write config cache: %s - %s", path, strerror(errno));
+		logstring(log);
+	}
+
+	free(tmp);
+	free(path);
+}
+
+/*
+ * records the applied layout as the state of the connected outputs on
+ * this screen, replacing the previous record of their key in the state file
+ */
+static void
+savestate(const Layout *l, const char *name)
+{
+	FILE *in;
+	FILE *out;
+	char *path;
+	char *tmp;
+	char *line = NULL;
+	const char *primary = "-";
+	size_t cap = 0;
+	uint64_t key;
+	uint64_t mtime;
+	uint64_t size;
+	int lock;
+	int fail;
+
+	/* the fields are tab separated and the outputs space separated */
+	if (strpbrk(name, "\t\n"))
+		return;
+	for (size_t i = 0; i < l->mc; i++) {
+		if (!l->m[i].id || strpbrk(l->m[i].id, " \t\n"))
+			return;
+		if (l->m[i].primary)
+			primary = l->m[i].id;
+	}
+
+	key = statekey(getsignature());
+	getcfgkey(&mtime, &size);
+
+	path = getpath(statepath);
+	tmp = gettmppath(path);
+	makedirs(tmp);
+	lock = lockpath(path);
+
+	if (!(out = fopen(tmp, "w"))) {
+		fail = 1;
+	} else {
+		/* the records of the other keys are kept */
+		if ((in = fopen(path, "r"))) {
+			while (getline(&line, &cap, in) > 0) {
+				if (strtoull(line, NULL, 16) != key)
+					fputs(line, out);
+			}
+			fclose(in);
+			free(line);
+		}
+
+		fprintf(out, "%016llx\t%llu\t%llu\t%s\t%s", (unsigned long long) key,
+		        (unsigned long long) mtime, (unsigned long long) size, name[0] ? name : "-", primary);
+		for (size_t i = 0; i < l->mc; i++) {
+			fprintf(out, "\t%s %u %u %lu %u", l->m[i].id, l->m[i].xoffset, l->m[i].yoffset,
+			        (unsigned long) l->m[i].rid, l->m[i].rotation);
+		}
+		fputc('\n', out);
+
+		fail = ferror(out);
+		if (fclose(out))
+			fail = 1;
+		if (fail || rename(tmp, path)) {
+			fail = 1;
+			unlink(tmp);
+		}
+	}
+
+	if (fail) {
+		char log[LOG_SIZE];
+
+		snprintf(log, sizeof(log), "WARN - Failed to write state: %s - %s", path, strerror(errno));
+		logstring(log);
+	}
+
+	if (lock >= 0)
+		close(lock);
+	free(tmp);
+	free(path);
+}
+
+/* sends a command to the daemon and returns its whole reply */
+static char*
+senddaemon(int fd, const char *command)
+{
+	char *reply = NULL;
+	size_t len = 0;
+	size_t cap = 0;
+	ssize_t ret;
+
+	if (writeall(fd, command, strlen(command)) || writeall(fd, "\n", 1))
+		fprintf(stderr, "xrandr-setup - failed to send the command to the daemon - %s\n", strerror(errno));
+	shutdown(fd, SHUT_WR);
+
+	do {
+		if (len + BUF_SIZE > cap) {
+			cap = cap ? cap * 2 : BUF_SIZE * 2;
+			if (!(reply = realloc(reply, cap)))
+				dielog("realloc()");
+		}
+		if ((ret = read(fd, reply + len, cap - len - 1)) > 0)
+			len += (size_t) ret;
+	} while (ret > 0 || (ret < 0 && errno == EINTR));
+
+	reply[len] = '\0';
+	return reply;
+}
+
+/*
+ * sends only the changes of the plan. Crtcs that are turned off, change
+ * outputs or would not fit the final framebuffer are turned off, the
+ * framebuffer is resized once and then the crtcs are set. When a crtc
+ * outside the plan prevents that order, the framebuffer is grown before
+ * the crtcs are set and shrunk after instead. Returns the status of the
+ * first crtc that failed.
+ */
+static int
+sendplan(const Plan *p)
+{
+	const PlanCrtc *pc;
+	Status status;
+	RROutput id;
+	int grow = 0;
+
+	if (!p->ordered) {
+		grow = p->resize && ((int) p->width > p->cur.width || (int) p->height > p->cur.height);
+		if (grow) {
+			XRRSetScreenSize(dpy, root,
+			                 (int) p->width > p->cur.width ? (int) p->width : p->cur.width,
+			                 (int) p->height > p->cur.height ? (int) p->height : p->cur.height,
+			                 (int) p->width > p->cur.width ? (int) p->mmwidth : p->cur.mwidth,
+			                 (int) p->height > p->cur.height ? (int) p->mmheight : p->cur.mheight);
+		}
+	}
+
+	for (size_t i = 0; i < p->ncrtc; i++) {
+		pc = &p->crtcs[i];
+		if (pc->disable && (status = setcrtc(pc->cur, pc->cur->timestamp, 0, 0, None, RR_Rotate_0, NULL, 0)))
+			return status;
+	}
+	if (p->ordered && p->resize)
+		XRRSetScreenSize(dpy, root, p->width, p->height, p->mmwidth, p->mmheight);
+
+	/* a crtc turned off above was set since its snapshot timestamp */
+	for (size_t i = 0; i < p->ncrtc; i++) {
+		pc = &p->crtcs[i];
+		if (!pc->output)
+			continue;
+		id = pc->output->id;
+		status = setcrtc(pc->cur, pc->disable ? CurrentTime : pc->cur->timestamp,
+		                 pc->x, pc->y, pc->mode, pc->rotation, &id, 1);
+		if (status)
+			return status;
+	}
+
+	if (p->primary)
+		XRRSetOutputPrimary(dpy, root, p->primary->id);
+
+	if (!p->ordered && p->resize && (!grow || (int) p->width < p->cur.width || (int) p->height < p->cur.height))
+		XRRSetScreenSize(dpy, root, p->width, p->height, p->mmwidth, p->mmheight);
+
+	return 0;
+}
+
+/*
+ * serves one client of the control socket: reads a command line and
+ * replies with lines, errors starting with "ERROR - ", then hangs up.
+ *   list                 the matching screens as "name<tab>index"
+ *   apply <index|name>   applies one of the listed screens
+ *   auto                 applies the default layout
+ *   reload               loads the config again
+ *   status               the connected outputs and the layout applied to them
+ */
+static void
+servecontrol(int fd, const char *cmd, CfgScreens **cs)
+{
+	StateRecord r;
+	char reply[BUF_SIZE];
+	char log[LOG_SIZE];
+	const char *name;
+	const char *arg;
+	char **id;
+	size_t *match;
+	size_t len = 0;
+	size_t n;
+	size_t mc;
+	char *end;
+
+	snprintf(log, sizeof(log), "DEBUG - Control command: %.200s", cmd);
+	logstring(log);
+
+	match = matchscreens(*cs, &n);
+	arg = strchr(cmd, ' ') ? strchr(cmd, ' ') + 1 : "";
+
+	if (!strcmp(cmd, "list")) {
+		for (size_t i = 0; i < n; i++) {
+			name = getstring(*cs, (*cs)->s[match[i]].name);
+			len = (size_t) snprintf(reply, sizeof(reply), "%s\t%zu\n", name ? name : "", i);
+			if (writeall(fd, reply, len < sizeof(reply) ? len : sizeof(reply) - 1))
+				break;
+		}
+	} else if (!strncmp(cmd, "apply ", 6)) {
+		size_t i = strtoul(arg, &end, 10);
+
+		/* an index into list, or else a name */
+		if (*end || end == arg) {
+			for (i = 0; i < n; i++) {
+				if ((name = getstring(*cs, (*cs)->s[match[i]].name)) && !strcmp(name, arg))
+					break;
+			}
+		}
+
+		if (i < n) {
+			applyscreen(*cs, &(*cs)->s[match[i]], 1);
+			snprintf(reply, sizeof(reply), "OK\n");
+		} else {
+			snprintf(reply, sizeof(reply), "ERROR - No matching layout: %.200s\n", arg);
+		}
+		writeall(fd, reply, strlen(reply));
+	} else if (!strcmp(cmd, "auto")) {
+		applyscreen(*cs, NULL, 0);
+		writeall(fd, "OK\n", 3);
+	} else if (!strcmp(cmd, "reload")) {
+		if (!reloadscreens(cs))
+			snprintf(reply, sizeof(reply), "OK\n");
+		else
+			snprintf(reply, sizeof(reply), "ERROR - Failed to load the configuration, the previous one is kept\n");
+		writeall(fd, reply, strlen(reply));
+	} else if (!strcmp(cmd, "status")) {
+		id = getconnected(&mc);
+		len = (size_t) snprintf(reply, sizeof(reply), "outputs:");
+		for (size_t i = 0; i < mc && len < sizeof(reply); i++)
+			len += (size_t) snprintf(reply + len, sizeof(reply) - len, " %s", id[i]);
+		freeconnected(id, mc);
+
+		fetchedids();
+		for (size_t i = 0; i < snap.noutput && len < sizeof(reply); i++) {
+			if (snap.outputs[i].connection == RR_Connected && snap.outputs[i].edid[0])
+				len += (size_t) snprintf(reply + len, sizeof(reply) - len, "\nedid %s: %s",
+				                         snap.outputs[i].name, snap.outputs[i].edid);
+		}
+
+		if (len < sizeof(reply)) {
+			if (loadstate(getsignature(), &r))
+				len += (size_t) snprintf(reply + len, sizeof(reply) - len, "\nlayout: %s",
+				                         r.name[0] ? r.name : "(default)");
+			freestate(&r);
+		}
+		if (len < sizeof(reply))
+			len += (size_t) snprintf(reply + len, sizeof(reply) - len, "\nmatching: %zu\nscreens: %zu\n",
+			                         n, *cs ? (*cs)->sc : 0);
+		writeall(fd, reply, len < sizeof(reply) ? len : sizeof(reply) - 1);
+	} else {
+		snprintf(reply, sizeof(reply), "ERROR - Unknown command: %.200s\n", cmd);
+		writeall(fd, reply, strlen(reply));
+	}
+
+	free(match);
+	close(fd);
+	logflush();
+}
+
+/*
+ * sets a crtc, retrying with fresh timestamps when the server reports that
+ * the configuration or the crtc changed since they were fetched
+ */
+static Status
+setcrtc(const SnapCrtc *c, Time timestamp, int x, int y, RRMode mode, Rotation rotation,
+        RROutput *outputs, int noutput)
+{
+	XRRCrtcInfo *info;
+	Status status;
+
+	for (int retry = 0; retry < 3; retry++) {
+		status = XRRSetCrtcConfig(dpy, resources, c->id, timestamp, x, y, mode, rotation, outputs, noutput);
+		countroundtrip();
+
+		if (status == RRSetConfigInvalidConfigTime) {
+			XRRFreeScreenResources(resources);
+			resources = XRRGetScreenResourcesCurrent(dpy, root);
+			countroundtrip();
+		} else if (status == RRSetConfigInvalidTime) {
+			countroundtrip();
+			if (!(info = XRRGetCrtcInfo(dpy, resources, c->id)))
+				return status;
+			timestamp = info->timestamp;
+			XRRFreeCrtcInfo(info);
+		} else {
+			return status;
+		}
+	}
+
+	return status;
+}
+
+/* applies the layout, returns 1 if that failed */
+static int
+setlayout(Layout *l)
+{
+	int prev;
+	int ret;
+	Plan p;
+
+	for (size_t i = 0; i < l->mc; i++) {
+		if (l->m[i].rid == 0) {
+			setupemptylayout(l);
+			setuplayout(l);
+			logstring("WARN - Configuration error. Loading default config.");
+			break;
+		}
+	}
+
+	newplan(&p, l);
+	logplan(&p);
+	prev = setphase(PHASE_APPLY);
+	ret = applyplan(&p);
+	setphase(prev);
+	freeplan(&p);
+	logflush();
+	return ret;
+}
+
+/*
+ * makes phase the current one, returns the previous to switch back to.
+ * The time and requests since the last switch go to the phase before, so
+ * a phase entered within another is not counted twice.
+ */
+static int
+setphase(int phase)
+{
+	int prev = curphase;
+	unsigned long req = 0;
+	long long now;
+
+	if (!timings)
+		return prev;
+
+	now = getusec();
+	if (dpy) {
+		req = (uint32_t) (NextRequest(dpy) - 1);
+		if ((uint32_t) (xcbrequest - req) < UINT32_MAX / 2)
+			req = xcbrequest;
+	}
+
+	if (prev >= 0) {
+		phases[prev].usec += now - phasemark;
+		phases[prev].requests += (uint32_t) (req - phasereq);
+	}
+	if (phase >= 0 && phase != prev)
+		phases[phase].runs++;
+
+	curphase = phase;
+	phasemark = now;
+	phasereq = req;
+	return prev;
+}
+
+/*
+ * makes each sink provider display the outputs of its source, unless it
+ * already does, returns 1 if it set any
+ */
+static int
+setproviders(const ProviderLink *links, size_t n)
+{
+	XRRProviderResources *pr;
+	XRRProviderInfo **info;
+	XErrorHandler xerrorxlib;
+	char log[LOG_SIZE];
+	int source;
+	int sink;
+	int linked;
+	int set = 0;
+
+	countroundtrip();
+	if (!(pr = XRRGetProviderResources(dpy, root)))
+		return 0;
+	if (!(info = calloc(pr->nproviders + 1, sizeof(XRRProviderInfo*))))
+		dielog("calloc()");
+	for (int i = 0; i < pr->nproviders; i++) {
+		countroundtrip();
+		info[i] = XRRGetProviderInfo(dpy, resources, pr->providers[i]);
+	}
+
+	xerror = 0;
+	xerrorxlib = XSetErrorHandler(xerrorhandler);
+
+	for (size_t i = 0; i < n; i++) {
+		source = -1;
+		sink = -1;
+		for (int j = 0; j < pr->nproviders; j++) {
+			if (info[j] && !strcmp(info[j]->name, links[i].source))
+				source = j;
+			if (info[j] && !strcmp(info[j]->name, links[i].sink))
+				sink = j;
+		}
+		if (source < 0 || sink < 0) {
+			snprintf(log, sizeof(log), "DEBUG - Provider %.100s is not available, it is not linked",
+			         source < 0 ? links[i].source : links[i].sink);
+			logstring(log);
+			continue;
+		}
+
+		linked = 0;
+		for (int k = 0; k < info[sink]->nassociatedproviders; k++)
+			linked = linked || info[sink]->associated_providers[k] == pr->providers[source];
+		if (linked)
+			continue;
 
-	path = getpath(logpath);
+		XRRSetProviderOutputSource(dpy, pr->providers[sink], pr->providers[source]);
+		snprintf(log, sizeof(log), "INFO - Provider %.100s set to display the outputs of %.100s",
+		         links[i].sink, links[i].source);
+		logstring(log);
+		set = 1;
+	}
 
-	if (!(fp = fopen(path, "a"))) {
-		fprintf(stderr, "ERROR - Failed to open in append mode, path: %s - %s\n", path, strerror(errno));
-		exit(errno);
+	if (set) {
+		XSync(dpy, False);
+		countroundtrip();
+		if (xerror) {
+			snprintf(log, sizeof(log), "ERROR - Linking the providers failed (X error %d)", xerror);
+			logstring(log);
+		}
+	}
+	XSetErrorHandler(xerrorxlib);
+
+	for (int i = 0; i < pr->nproviders; i++) {
+		if (info[i])
+			XRRFreeProviderInfo(info[i]);
 	}
+	free(info);
+	XRRFreeProviderResources(pr);
+	return set;
+}
 
-	time(&rawtime);
-	timeinfo = localtime(&rawtime);
+static void
+setup(void)
+{
+	int prev;
 
-	fprintf(fp, "%d-%02d-%02d %02d:%02d:%02d xrandr-setup\n%s\n\n", timeinfo->tm_year+1900,
-		timeinfo->tm_mon+1, timeinfo->tm_mday, timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec, string);
+	prev = setphase(PHASE_CONNECT);
+	dpy = XOpenDisplay(NULL);
 	
-	fclose(fp);
-	free(path);
+	if (dpy == NULL)
+		dielog("XOpenDisplay()");
+	countroundtrip();
+	setphase(prev);
+
+	root = XDefaultRootWindow(dpy);
 }
 
-/* removes all screens that don't match the connected monitors */
+/* replaces the monitors of the layout with every connected output, at its defaults */
 static void
-matchscreens(CfgScreens *cs)
+setupemptylayout(Layout *l)
 {
-	XRROutputInfo *output;
-	size_t mc;
-	char **id;
-	char **temp;
-	unsigned int match;
-
-	if (!cs)
-		return;
+	freelayout(l);
+	l->dpi = 0;
+	l->name = NULL;
 
-	if (!(id = malloc(sizeof(char*))))
+	if (!(l->m = malloc((snap.noutput + 1) * sizeof(LayoutMonitor))))
 		dielog("malloc()");
-	mc = 0;
 
-	for (int i = 0; i < resources->noutput; i++) {
-		output = XRRGetOutputInfo(dpy, resources, resources->outputs[i]);
-		if (!output->connection) {
-			mc++;
-			if (!(temp = realloc(id, mc * sizeof(char*))))
-				dielog("realloc()");
-			temp[mc-1] = strdup(output->name);
-			id = temp;
+	for (size_t i = 0; i < snap.noutput; i++) {
+		if (snap.outputs[i].connection == RR_Connected) {
+			initmonitor(&l->m[l->mc]);
+			l->m[l->mc++].id = snap.outputs[i].name;
 		}
-		XRRFreeOutputInfo(output);
 	}
+}
 
-	for (size_t i = cs->sc - 1; i < cs->sc; i--) {
-		if (cs->s[i]->mc != mc) {
-			removescreen(cs, i);
-			continue;
-		}
-		for (size_t j = 0; j < mc; j++) {
-			match = 0;
-			for (size_t k = 0; k < mc; k++) {
-				if (!strcmp(cs->s[i]->m[j]->id, id[k]))
-					match++;
-			}
-			if (match != 1) {
-				removescreen(cs, i);
-				break;
+/* fills all the missing data of the selected layout */
+static void
+setuplayout(Layout *l)
+{
+	SnapOutput *output;
+
+	for (size_t i = 0; i < snap.noutput; i++) {
+		output = &snap.outputs[i];
+		if (output->connection == RR_Connected) {
+			for (size_t j = 0; j < l->mc; j++) {
+				if (!strcmp(l->m[j].id, output->name)) {
+					setupmonitor(&l->m[j], output);
+					break;
+				}
 			}
 		}
 	}
 }
 
+/*
+ * fills the missing mode of the monitor with the largest one and resolves
+ * the mode id. The sorted modes of the output start with the largest width,
+ * then height, then rate, so the first mode of each run is the default.
+ * Of the modes with the requested resolution the one with the nearest rate
+ * is taken, if it is within the tolerance of the monitor.
+ */
 static void
-newmonitor(CfgScreen *s)
+setupmonitor(LayoutMonitor *m, const SnapOutput *output)
 {
-	CfgMonitor *m;
+	SnapMode *mode;
+	SnapMode *best = NULL;
+	char log[LOG_SIZE];
+	double dist;
+	double bestdist = 0.0;
+	int lo = 0;
+	int hi;
 
-	s->mc++;
-	if (!(s->m = realloc(s->m, s->mc * sizeof(CfgMonitor*))))
-		dielog("realloc()");
+	if (!output->nsorted)
+		return;
 
-	if (!(m = malloc(sizeof(CfgMonitor))))
-		dielog("malloc()");
+	if (!m->xmode)
+		m->xmode = output->sorted[0]->width;
 
-	s->m[s->mc - 1] = m;
+	/* find the first mode with the requested width */
+	hi = output->nsorted;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
 
-	m->id       = NULL;
-	m->primary  = 0;
-	m->xoffset  = 0;
-	m->yoffset  = 0;
-	m->xmode    = 0;
-	m->ymode    = 0;
-	m->rate     = 0.0;
-	m->moderot  = 0;
-	m->rotation = RR_Rotate_0;
-}
+		if (output->sorted[mid]->width > m->xmode)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-static void
-newscreen(CfgScreens *ss)
-{
-	CfgScreen *s;
+	for (int i = lo; i < output->nsorted && output->sorted[i]->width == m->xmode; i++) {
+		mode = output->sorted[i];
+		if (!m->ymode)
+			m->ymode = mode->height;
+		if (mode->height != m->ymode)
+			continue;
+		if (m->rate == 0.0)
+			m->rate = mode->rate;
 
-	ss->sc++;
-	if (!(ss->s = realloc(ss->s, ss->sc * sizeof(CfgScreen*))))
-		dielog("realloc()");
+		dist = mode->rate > m->rate ? mode->rate - m->rate : m->rate - mode->rate;
+		if (!best || dist < bestdist) {
+			best = mode;
+			bestdist = dist;
+		}
+	}
 
-	if (!(s = malloc(sizeof(CfgScreen))))
-		dielog("malloc()");
+	/* check if the final monitor mode is valid */
+	if (!best)
+		return;
 
-	ss->s[ss->sc - 1] = s;
-	s->dpi = 0;
-	s->mc = 0;
-	s->m = NULL;
-	s->name = NULL;
-}
+	if (bestdist > m->tolerance) {
+		snprintf(log, sizeof(log), "WARN - Monitor %s: no %ux%u mode within %.2lf Hz of %.2lf Hz, nearest is %.2lf Hz",
+		         m->id, m->xmode, m->ymode, m->tolerance, m->rate, best->rate);
+		logstring(log);
+		return;
+	}
 
-static void
-parsemonitor(CfgScreen *s, TomlArray *monitor)
-{
-	char *id;
-	unsigned int primary;
-	unsigned int xoffset;
-	unsigned int yoffset;
-	unsigned int xmode;
-	unsigned int ymode;
-	double rate;
-	char *rotation;
-
-	newmonitor(s);
-
-	if (!tomlgetstring(monitor, "id", &id))
-		s->m[s->mc - 1]->id = strdup(id);
-	if (!tomlgetbool(monitor, "primary", &primary))
-		s->m[s->mc - 1]->primary = primary;
-	if (!tomlgetuint(monitor, "xoffset", &xoffset))
-		s->m[s->mc - 1]->xoffset = xoffset;
-	if (!tomlgetuint(monitor, "yoffset", &yoffset))
-		s->m[s->mc - 1]->yoffset = yoffset;
-	if (!tomlgetuint(monitor, "xmode", &xmode))
-		s->m[s->mc - 1]->xmode = xmode;
-	if (!tomlgetuint(monitor, "ymode", &ymode))
-		s->m[s->mc - 1]->ymode = ymode;
-	if (!tomlgetdouble(monitor, "rate", &rate))
-		s->m[s->mc - 1]->rate = rate;
-	if (!tomlgetstring(monitor, "rotation", &rotation)) {
-		if (!strcmp(rotation, "normal"))
-			s->m[s->mc - 1]->rotation = RR_Rotate_0;
-		else if (!strcmp(rotation, "inverted"))
-			s->m[s->mc - 1]->rotation = RR_Rotate_180;
-		else if (!strcmp(rotation, "left"))
-			s->m[s->mc - 1]->rotation = RR_Rotate_270;
-		else if (!strcmp(rotation, "right"))
-			s->m[s->mc - 1]->rotation = RR_Rotate_90;
+	if (bestdist >= 0.005) {
+		snprintf(log, sizeof(log), "DEBUG - Monitor %s: requested %.2lf Hz, using %.2lf Hz",
+		         m->id, m->rate, best->rate);
+		logstring(log);
 	}
+
+	m->rid = best->id;
 }
 
-static void
-parsescreen(CfgScreens *cs, TomlArray *screen)
+/* returns a hash of the sorted ids, equal for equal sets in any order */
+static uint64_t
+signature(char **id, size_t n)
 {
-	TomlArrayKey *monitors = NULL;
-	char *name;
-	unsigned int dpi;
+	char **sorted;
+	uint64_t hash = 14695981039346656037ULL;
 
-	newscreen(cs);
-
-	if (!tomlgetstring(screen, "name", &name))
-		cs->s[cs->sc - 1]->name = strdup(name);
-	if (!tomlgetuint(screen, "dpi", &dpi))
-		cs->s[cs->sc - 1]->dpi = dpi;
+	if (!(sorted = malloc((n + 1) * sizeof(char*))))
+		dielog("malloc()");
+	memcpy(sorted, id, n * sizeof(char*));
+	qsort(sorted, n, sizeof(char*), cmpstr);
 
-	if (!(monitors = tomlgetarraykey(screen, "monitor")))
-		return;
+	/* FNV-1a, with the terminators separating the ids */
+	for (size_t i = 0; i < n; i++) {
+		for (const char *c = sorted[i]; ; c++) {
+			hash ^= (unsigned char) *c;
+			hash *= 1099511628211ULL;
+			if (!*c)
+				break;
+		}
+	}
 
-	for (size_t i = 0; i < monitors->narr; i++)
-		parsemonitor(cs->s[cs->sc - 1], monitors->arr[i]);
+	free(sorted);
+	return hash;
 }
 
+/* starts the prompt application with its stdin and stdout on pipes */
 static void
-printhelp(void)
+spawnprompt(Prompt *p, char *argv[])
 {
-	printf("xrandr-setup\nThis is an application for setting xRandR using premade configuration files for your screens\n");
-	printf("\nUsage:\n");
-	printf("\t'-h' or '--help'      prints this menu\n");
-	printf("\t'-a' or '--auto'      sets up with a basic screen ignoring the config files\n");
-	printf("\t'-s' or '--select'    prompts through the selected applications for a layout (the prompt args are passed through argv)\n");
-}
+	int writepipe[2];
+	int readpipe[2];
+	char *path;
+	char **args;
+	const char *name = NULL;
+	size_t argc = 0;
 
-static void
-removescreen(CfgScreens *cs, const int index)
-{
-	freescreen(cs->s[index]);
-	for (size_t i = index; i < cs->sc - 1; i++)
-		cs->s[i] = cs->s[i + 1];
-	cs->sc--;
-}
+	p->pid = -1;
 
-static void
-setscreen(CfgScreen *s)
-{
-	XRROutputInfo *output;
-	XRRCrtcInfo *crtc;
+	path = getpath(pmtpath);
+	for (const char **ptr = pmtpath; *ptr != NULL; ptr++)
+		name = *ptr;
 
-	for (size_t i = 0; i < s->mc; i++) {
-		if (s->m[i]->rid == 0) {
-			setupemptyscreen(&s);
-			logstring("WARN - Configuration error. Loading default config.");
-			break;
-		}
-	}
+	for (char **ptr = argv; *ptr != NULL; ptr++)
+		argc++;
 
-	setupscreensize(s, 0);
+	if (!(args = malloc((argc + 2) * sizeof(char*))))
+		dielog("malloc()");
 
-	for (int i = 0; i < resources->noutput; i++) {
-		output = XRRGetOutputInfo(dpy, resources, resources->outputs[i]);
-		for (size_t j = 0; j < s->mc; j++) {
-			if (!strcmp(s->m[j]->id, output->name)) {
-				crtc = XRRGetCrtcInfo(dpy, resources, output->crtc);
-				XRRSetCrtcConfig(dpy, resources, output->crtc,
-				                 crtc->timestamp, s->m[j]->xoffset, s->m[j]->yoffset,
-				                 s->m[j]->rid, s->m[j]->rotation, crtc->outputs,
-				                 crtc->noutput);
-				XRRFreeCrtcInfo(crtc);
-				if (s->m[j]->primary)
-					XRRSetOutputPrimary(dpy, root, resources->outputs[i]);
-			}
-		}
-		XRRFreeOutputInfo(output);
+	args[0] = (char*) name;
+	for (size_t i = 0; i < argc; i++)
+		args[i+1] = argv[i];
+	args[argc+1] = NULL;
+
+	if (pipe(writepipe) < 0) {
+		logstring("ERROR - Failed to initialize pipes");
+		free(args);
+		free(path);
+		return;
+	}
+	if (pipe(readpipe) < 0) {
+		logstring("ERROR - Failed to initialize pipes");
+		close(writepipe[0]);
+		close(writepipe[1]);
+		free(args);
+		free(path);
+		return;
 	}
 
-	setupscreensize(s, 1);
-}
+	/* or the child would inherit the buffered records */
+	logflush();
 
-static void
-setup(void)
-{
-	dpy = XOpenDisplay(NULL);
-	
-	if (dpy == NULL)
-		dielog("XOpenDisplay()");
+	switch ((p->pid = fork())) {
+		case -1:
+			logstring("ERROR - fork() failed");
+			close(writepipe[0]);
+			close(writepipe[1]);
+			close(readpipe[0]);
+			close(readpipe[1]);
+			break;
 
-	root = XDefaultRootWindow(dpy);
-	resources = XRRGetScreenResources(dpy, root);
-}
+		case 0: /* child - prompt application */
+			close(writepipe[1]);
+			close(readpipe[0]);
 
-static void
-setupemptyscreen(CfgScreen **s)
-{
-	XRROutputInfo *output;
+			dup2(writepipe[0], STDIN_FILENO);
+			close(writepipe[0]);
+
+			dup2(readpipe[1], STDOUT_FILENO);
+			close(readpipe[1]);
+			
+			execv(path, args);
+			_exit(EXIT_FAILURE);
+
+		default: /* parent */
+			close(writepipe[0]);
+			close(readpipe[1]);
+			p->in = writepipe[1];
+			p->out = readpipe[0];
 
-	if (*s) {
-		freescreen(*s);
-		*s = NULL;
+			/* a prompt that exits early fails the writes instead of killing us */
+			signal(SIGPIPE, SIG_IGN);
+			fcntl(p->in, F_SETFL, fcntl(p->in, F_GETFL) | O_NONBLOCK);
 	}
 
-	*s = malloc(sizeof(CfgScreen));
-	(*s)->mc = 0;
-	(*s)->m = NULL;
-	(*s)->dpi = 0;
-	(*s)->name = NULL;
+	free(args);
+	free(path);
+}
+
+/*
+ * returns the key of the state records of a signature, the signature
+ * continued over the display name and the screen, so the displays of
+ * --displays with the same output names keep their own layouts
+ */
+static uint64_t
+statekey(uint64_t sig)
+{
+	char screen[BUF_SIZE];
 
-	for (int i = 0; i < resources->noutput; i++) {
-		output = XRRGetOutputInfo(dpy, resources, resources->outputs[i]);
-		if (!output->connection) {
-			newmonitor(*s);
-			(*s)->m[(*s)->mc - 1]->id = strdup(output->name);
-		}
-		XRRFreeOutputInfo(output);
+	snprintf(screen, sizeof(screen), "%s %d", DisplayString(dpy), DefaultScreen(dpy));
+	for (const char *c = screen; *c; c++) {
+		sig ^= (unsigned char) *c;
+		sig *= 1099511628211ULL;
 	}
+	return sig;
 }
 
-static void
-setupmonitor(CfgMonitor *m, XRROutputInfo *output)
+/*
+ * writes the entries of the matched screens to the prompt while reading
+ * what it prints, so neither blocks on a full pipe. The entries are queued
+ * in batches of iovecs, the names pointing into the string pool, and sent
+ * with writev(), resuming within the iovec a partial write stopped in.
+ * Returns the output of the prompt.
+ */
+static char*
+streamprompt(Prompt *p, const CfgScreens *cs, const size_t *match, size_t n)
 {
-	XRRModeInfo *mode;
-	double rate;
-	char str1[16];
-	char str2[16];
-
-	if (!m->xmode) {
-		for (int i = 0; i < output->nmode; i++) {
-			for (int j = 0; j < resources->nmode; j++) {
-				if (output->modes[i] == resources->modes[j].id) {
-					mode = &resources->modes[j];
-					if (mode->width > m->xmode)
-						m->xmode = mode->width;
+	struct iovec iov[PROMPT_BATCH * 2];
+	struct pollfd pfd[2];
+	char index[PROMPT_BATCH][24];
+	const char *name;
+	char *out = NULL;
+	size_t len = 0;
+	size_t cap = 0;
+	size_t next = 0;
+	size_t niov = 0;
+	size_t cur = 0;
+	ssize_t ret;
+
+	pfd[0].fd = p->in;
+	pfd[0].events = POLLOUT;
+	pfd[1].fd = p->out;
+	pfd[1].events = POLLIN;
+
+	while (pfd[0].fd >= 0 || pfd[1].fd >= 0) {
+		if (pfd[0].fd >= 0 && cur == niov) {
+			niov = cur = 0;
+			for (size_t i = 0; next < n && i < PROMPT_BATCH; i++, next++) {
+				/* empty names are not queued, so every iovec moves the write on */
+				if ((name = getstring(cs, cs->s[match[next]].name)) && name[0]) {
+					iov[niov].iov_base = (void*) name;
+					iov[niov++].iov_len = strlen(name);
 				}
+				iov[niov].iov_base = index[i];
+				iov[niov++].iov_len = (size_t) snprintf(index[i], sizeof(index[i]), "\t%zu\n", next);
 			}
-		}
-	}
 
-	if (!m->ymode) {
-		for (int i = 0; i < output->nmode; i++) {
-			for (int j = 0; j < resources->nmode; j++) {
-				if (output->modes[i] == resources->modes[j].id) {
-					mode = &resources->modes[j];
-					if (mode->width != m->xmode)
-						continue;
-					if (mode->height > m->ymode)
-						m->ymode = mode->height;
-				}
+			/* everything is sent, the prompt sees the end of its input */
+			if (!niov) {
+				close(p->in);
+				p->in = pfd[0].fd = -1;
+				continue;
 			}
 		}
-	}
 
-	if (m->rate == 0.0) {
-		for (int i = 0; i < output->nmode; i++) {
-			for (int j = 0; j < resources->nmode; j++) {
-				if (output->modes[i] == resources->modes[j].id) {
-					mode = &resources->modes[j];
-					if ((mode->width != m->xmode) || (mode->height!= m->ymode))
-						continue;
-					rate = (double) mode->dotClock / (double) (mode->hTotal * mode->vTotal);
-					if (rate > m->rate)
-						m->rate = rate;
-				}
-			}
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
 		}
-	}
 
-	/* check if the final monitor mode is valid */
-	for (int i = 0; i < output->nmode; i++) {
-		for (int j = 0; j < resources->nmode; j++) {
-			if (output->modes[i] == resources->modes[j].id) {
-				mode = &resources->modes[j];
-				if ((mode->width != m->xmode) || (mode->height!= m->ymode))
-					continue;
-				sprintf(str1, "%.0lf", m->rate);
-				sprintf(str2, "%.0lf", (double) mode->dotClock / (double) (mode->hTotal * mode->vTotal));
-				if (!strcmp(str1, str2)) {
-					m->rid = mode->id;
-					return;
+		if (pfd[0].fd >= 0 && pfd[0].revents) {
+			if ((ret = writev(p->in, iov + cur, (int) (niov - cur))) < 0 && errno != EAGAIN && errno != EINTR) {
+				/* the prompt stopped reading, what it printed is still read */
+				close(p->in);
+				p->in = pfd[0].fd = -1;
+			}
+			while (ret > 0) {
+				if ((size_t) ret >= iov[cur].iov_len) {
+					ret -= (ssize_t) iov[cur++].iov_len;
+				} else {
+					iov[cur].iov_base = (char*) iov[cur].iov_base + ret;
+					iov[cur].iov_len -= (size_t) ret;
+					ret = 0;
 				}
 			}
 		}
-	}
-}
 
-/* fills all the missing data of the selected screen */
-static void
-setupscreen(CfgScreen *s)
-{
-	XRROutputInfo *output;
-
-	for (int i = 0; i < resources->noutput; i++) {
-		output = XRRGetOutputInfo(dpy, resources, resources->outputs[i]);
-		if (!output->connection) {
-			for (size_t i = 0; i < s->mc; i++) {
-				if (!strcmp(s->m[i]->id, output->name)) {
-					setupmonitor(s->m[i], output);
-					break;
-				}
+		if (pfd[1].fd >= 0 && pfd[1].revents) {
+			if (len + BUF_SIZE > cap) {
+				cap = cap ? cap * 2 : BUF_SIZE * 2;
+				if (!(out = realloc(out, cap)))
+					dielog("realloc()");
+			}
+			if ((ret = read(p->out, out + len, cap - len - 1)) > 0) {
+				len += (size_t) ret;
+			} else if (!ret || (errno != EAGAIN && errno != EINTR)) {
+				close(p->out);
+				p->out = pfd[1].fd = -1;
 			}
 		}
-		XRRFreeOutputInfo(output);
 	}
+
+	if (!out && !(out = malloc(1)))
+		dielog("malloc()");
+	out[len] = '\0';
+	return out;
 }
 
-static void
-setupscreensize(CfgScreen *s, unsigned int retract)
+/*
+ * watches the directory of the config file, as editors often save by
+ * renaming a new file over it. Returns the inotify fd, or -1 without one.
+ */
+static int
+watchconfig(char *name, size_t size)
 {
-	XRRScreenSize *scr;
-	unsigned int temp;
-	unsigned int width = 0;
-	unsigned int height = 0;
-	unsigned int mmWidth;
-	unsigned int mmHeight;
-	int nsizes;
-	double dpi;
-	
-	for (size_t i = 0; i < s->mc ; i++) {
-		if ((s->m[i]->rotation == RR_Rotate_90 || s->m[i]->rotation == RR_Rotate_270) && !s->m[i]->moderot) {
-			temp = s->m[i]->xmode;
-			s->m[i]->xmode = s->m[i]->ymode;
-			s->m[i]->ymode= temp;
-			s->m[i]->moderot++;
-		}
-	}
+	char log[LOG_SIZE];
+	char *path;
+	char *sep;
+	int fd;
+
+	path = getpath(cfgpath);
+	sep = strrchr(path, '/');
+	snprintf(name, size, "%s", sep + 1);
+	*sep = '\0';
 
-	for (size_t i = 0; i < s->mc ; i++) {
-		if (s->m[i]->yoffset + s->m[i]->ymode > height)
-			height = s->m[i]->yoffset + s->m[i]->ymode;
-		if (s->m[i]->xoffset + s->m[i]->xmode > width)
-			width = s->m[i]->xoffset + s->m[i]->xmode;
+	if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0
+	    || inotify_add_watch(fd, path, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		snprintf(log, sizeof(log), "WARN - Failed to watch %s, config changes need a reload - %s",
+		         path, strerror(errno));
+		logstring(log);
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
 	}
 
-	scr = XRRSizes(dpy, 0, &nsizes);
+	free(path);
+	return fd;
+}
 
-	if (s->dpi)
-		dpi = (double) s->dpi;
-	else
-		dpi = (25.4 * scr[0].height) / scr[0].mheight;
-	
-	mmWidth  = (int) ((25.4 * width) / dpi);
-	mmHeight = (int) ((25.4 * height) / dpi);
+/* writes all of buf, returns 1 on failure */
+static int
+writeall(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
 
-	if (!retract) {
-		if (scr[0].width > (int) width) {
-			width = scr[0].width;
-			mmWidth = scr[0].mwidth;
-		}
-		
-		if (scr[0].height > (int) height) {
-			height = scr[0].height;
-			mmHeight = scr[0].mheight;
+	for (size_t off = 0; off < len; off += (size_t) n) {
+		if ((n = write(fd, (const char*) buf + off, len - off)) < 0) {
+			if (errno != EINTR)
+				return 1;
+			n = 0;
 		}
 	}
-	XRRSetScreenSize(dpy, root, width, height, mmWidth, mmHeight);
+
+	return 0;
+}
+
+/* records X errors of the apply instead of exiting, see applyplan() */
+static int
+xerrorhandler(Display *d, XErrorEvent *ee)
+{
+	(void) d;
+	xerror = ee->error_code;
+	return 0;
 }
 
 int
 main(int argc, char *argv[])
 {
-	CfgScreens *cs;
-	CfgScreen *s;
+	CfgScreens *cs = NULL;
+	Prompt pmt = { -1, -1, -1 };
+	size_t *match;
+	size_t nmatch;
+	char **prompt = NULL;
+	char *displays = NULL;
 	int selscreen = 0;
+	int daemon = 0;
+	int applied = 0;
+	int status = 0;
+	int fd;
 
-	setup();
-	cs = getcfgscreens();
-	matchscreens(cs);
+	atexit(logflush);
 
 	for (int i = 1; i < argc; i++) {
-		if (!strcmp(argv[i], "--auto") || !strcmp(argv[i], "-a")) {
+		if (!strcmp(argv[i], "--log") || !strcmp(argv[i], "-l")) {
+			loglevel = -1;
+			for (size_t j = 0; i + 1 < argc && j < LENGTH(loglevels); j++) {
+				if (!strcasecmp(argv[i+1], loglevels[j]))
+					loglevel = (int) j;
+			}
+			if (loglevel < 0) {
+				fprintf(stderr, "xrandr-setup - invalid log level. Execute with --help for usage\n");
+				cleanup(cs);
+				return 1;
+			}
+			i++;
+		} else if (!strcmp(argv[i], "--displays") || !strcmp(argv[i], "-D")) {
+			if (i + 1 >= argc || !argv[i+1][0]) {
+				fprintf(stderr, "xrandr-setup - missing display list. Execute with --help for usage\n");
+				cleanup(cs);
+				return 1;
+			}
+			displays = argv[++i];
+		} else if (!strcmp(argv[i], "--timings") || !strcmp(argv[i], "-t")) {
+			timings = 1;
+			if (i + 1 < argc && !strcmp(argv[i+1], "json")) {
+				timings = 2;
+				i++;
+			}
+		} else if (!strcmp(argv[i], "--probe") || !strcmp(argv[i], "-p")) {
+			if (i + 1 < argc && !strcmp(argv[i+1], "auto")) {
+				probemode = PROBE_AUTO;
+			} else if (i + 1 < argc && !strcmp(argv[i+1], "current")) {
+				probemode = PROBE_CURRENT;
+			} else if (i + 1 < argc && !strcmp(argv[i+1], "full")) {
+				probemode = PROBE_FULL;
+			} else {
+				fprintf(stderr, "xrandr-setup - invalid probe policy. Execute with --help for usage\n");
+				cleanup(cs);
+				return 1;
+			}
+			i++;
+		} else if (!strcmp(argv[i], "--daemon") || !strcmp(argv[i], "-d")) {
+			daemon = 1;
+			/* the quiet window is optional, the next argument is only taken if it is a number */
+			if (i + 1 < argc && argv[i+1][0] >= '0' && argv[i+1][0] <= '9') {
+				char *end;
+
+				debounce = (unsigned int) strtoul(argv[i+1], &end, 10);
+				if (*end != '\0') {
+					fprintf(stderr, "xrandr-setup - invalid debounce window: %s\n", argv[i+1]);
+					cleanup(cs);
+					return 1;
+				}
+				i++;
+			}
+		} else if (!strcmp(argv[i], "--auto") || !strcmp(argv[i], "-a")) {
 			selscreen = -1;
 			break;
+		} else if (!strcmp(argv[i], "--control") || !strcmp(argv[i], "-c")) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "xrandr-setup - missing control command. Execute with --help for usage\n");
+				cleanup(cs);
+				return 1;
+			}
+			if ((fd = connectdaemon()) < 0) {
+				fprintf(stderr, "xrandr-setup - no daemon is running\n");
+				cleanup(cs);
+				return 1;
+			}
+			return runclient(fd, NULL, argv[i+1]);
 		} else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h")) {
 			printhelp();
 			cleanup(cs);
 			return 0;
 		} else if (!strcmp(argv[i], "--select") || !strcmp(argv[i], "-s")) {
-			selscreen = getinputscreen(cs, &argv[i+1]);
+			prompt = &argv[i+1];
 			break;
 		} else {
 			fprintf(stderr, "xrandr-setup - invalid arguments. Execute with --help for usage\n");
@@ -845,24 +4506,70 @@ main(int argc, char *argv[])
 		}
 	}
 
-	if (cs && selscreen >=0 && cs->sc > 0) {
-		s = cs->s[selscreen];
-	} else {
-		if (cs) {
-			freescreens(cs);
-			cs = NULL;
+	if (displays && forkdisplays(displays, &status))
+		return status;
+
+	/* with a daemon running, it already has everything --select and --auto need */
+	if (!dpyname && !daemon && (prompt || selscreen == -1) && (fd = connectdaemon()) >= 0)
+		return runclient(fd, prompt, NULL);
+
+	/* the menu starts up while the outputs are probed and the config loaded */
+	if (prompt) {
+		setphase(PHASE_PROMPT);
+		spawnprompt(&pmt, prompt);
+	}
+
+	setup();
+
+	/*
+	 * without arguments nothing is done if the outputs are still as
+	 * recorded, and otherwise only the matching screen is needed
+	 */
+	if (!daemon && !prompt && !selscreen) {
+		probe(NULL, NULL, 0);
+		linkproviders(&cs);
+		setphase(PHASE_STATE);
+		if (checkstate()) {
+			logtimings("default");
+			cleanup(cs);
+			return 0;
 		}
-		cs = malloc(sizeof(CfgScreens));
-		cs->sc = 0;
-		cs->s = NULL;
+		setphase(PHASE_CONFIG);
+		if (!cs)
+			cs = getcfgscreens(&applied);
+		if (applied) {
+			logtimings("default");
+			cleanup(cs);
+			return 0;
+		}
+		if (probemode == PROBE_AUTO && probestale(cs))
+			probe(cs, NULL, 0);
+	} else {
+		setphase(PHASE_CONFIG);
+		cs = getcfgscreens(NULL);
+		probe(cs, NULL, 0);
+		linkproviders(&cs);
+	}
 
-		newscreen(cs);
-		s = cs->s[0];
-		setupemptyscreen(&s);
+	if (daemon)
+		rundaemon(cs);
+
+	setphase(PHASE_MATCH);
+	match = matchscreens(cs, &nmatch);
+	if (prompt) {
+		setphase(PHASE_PROMPT);
+		selscreen = getinputscreen(cs, match, nmatch, &pmt);
+	} else if (!selscreen) {
+		selscreen = (int) getpinnedscreen(cs, match, nmatch);
 	}
-	
-	setupscreen(s);
-	setscreen(s);
+
+	/* --auto is a one off, it is not recorded */
+	if (selscreen != -2)
+		applyscreen(cs, selscreen >= 0 && (size_t) selscreen < nmatch ? &cs->s[match[selscreen]] : NULL,
+		            selscreen != -1);
+
+	free(match);
+	logtimings(prompt ? "select" : selscreen == -1 ? "auto" : "default");
 	cleanup(cs);
 	return 0;
 }
@@ -0,0 +1,751 @@
+/*
+ * See LICENSE file for copyright and license details.
+ *
+ * mock RandR backend. It implements the part of Xlib and XRandR that
+ * xrandr-setup uses, replaying a topology recorded in the file named by
+ * $XRANDR_SETUP_MOCK instead of talking to an X server, so the whole
+ * program can be run and measured without one. Linked in place of libX11
+ * and libXrandr, see the xrandr-setup-mock and bench targets.
+ *
+ * A topology has one item per line, numbered from 1 in the order they
+ * appear, and # starts a comment:
+ *
+ *   mode <width> <height> <rate>
+ *   crtc
+ *   output <name> connected|disconnected [<mode>|<first>-<last>]...
+ *   edid <output> <vendor> <product> <serial>
+ *   lit <crtc> <mode> <x> <y> <output>...
+ *   primary <output>
+ *   screen <width> <height> <mmwidth> <mmheight>
+ *   provider <name>
+ *
+ * Every output can be driven by every crtc. The modes, crtcs and outputs set
+ * are applied to the topology, as a server would, and every request waiting
+ * for a reply sleeps for $XRANDR_SETUP_MOCK_LATENCY microseconds first.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <X11/extensions/Xrandr.h>
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+
+/* constants definition */
+#define BUF_SIZE 512
+#define CRTC_BASE 0x100 /* ids of each kind start apart, so a mixed up id is not found */
+#define OUTPUT_BASE 0x200
+#define PROVIDER_BASE 0x300
+#define MODE_BASE 0x1000
+#define EDID_ATOM 1
+#define EVENT_BASE 89
+
+/* structure definitions */
+typedef struct {
+	char *name;
+	int connected;
+	RRCrtc crtc;
+	int nmode;
+	RRMode *modes;
+	unsigned char edid[8]; /* bytes 8 to 15 of the EDID, the vendor, product and serial */
+	int hasedid;
+} MockOutput;
+
+typedef struct {
+	int x;
+	int y;
+	RRMode mode;
+	Rotation rotation;
+	int noutput;
+	RROutput *outputs;
+} MockCrtc;
+
+typedef struct {
+	char *name;
+	RRProvider source;
+} MockProvider;
+
+/* function definitions */
+static void addmode(MockOutput *o, unsigned long index);
+static MockCrtc* getcrtc(RRCrtc id);
+static XRRModeInfo* getmode(RRMode id);
+static MockOutput* getoutput(RROutput id);
+static void* grow(void *ptr, size_t n, size_t size);
+static void load(void);
+static void parseline(char *line);
+static void roundtrip(Display *d);
+static void sendrequest(Display *d);
+
+/* variable definitions */
+static XRRModeInfo *modes = NULL;
+static int nmode = 0;
+static MockCrtc *crtcs = NULL;
+static int ncrtc = 0;
+static MockOutput *outputs = NULL;
+static int noutput = 0;
+static MockProvider *providers = NULL;
+static int nprovider = 0;
+static RROutput primary = None;
+static Screen screen = { .width = 1920, .height = 1080, .mwidth = 508, .mheight = 286 };
+static Time configtime = 1;
+static long latency = 0;
+static XErrorHandler handler = NULL;
+static int loaded = 0;
+
+static void
+addmode(MockOutput *o, unsigned long index)
+{
+	if (!index || index > (unsigned long) nmode)
+		return;
+
+	o->modes = grow(o->modes, (size_t) o->nmode, sizeof(RRMode));
+	o->modes[o->nmode++] = MODE_BASE + index - 1;
+}
+
+static MockCrtc*
+getcrtc(RRCrtc id)
+{
+	return id >= CRTC_BASE && id < (RRCrtc) CRTC_BASE + ncrtc ? &crtcs[id - CRTC_BASE] : NULL;
+}
+
+static XRRModeInfo*
+getmode(RRMode id)
+{
+	return id >= MODE_BASE && id < (RRMode) MODE_BASE + nmode ? &modes[id - MODE_BASE] : NULL;
+}
+
+static MockOutput*
+getoutput(RROutput id)
+{
+	return id >= OUTPUT_BASE && id < (RROutput) OUTPUT_BASE + noutput ? &outputs[id - OUTPUT_BASE] : NULL;
+}
+
+/* makes room for one more element, the arrays are small enough to grow one at a time */
+static void*
+grow(void *ptr, size_t n, size_t size)
+{
+	if (!(ptr = realloc(ptr, (n + 1) * size))) {
+		perror("mock: realloc()");
+		exit(1);
+	}
+
+	return ptr;
+}
+
+/* reads the topology once, on the first connection */
+static void
+load(void)
+{
+	FILE *fp;
+	char line[BUF_SIZE];
+	const char *path;
+	const char *env;
+
+	if (loaded)
+		return;
+	loaded = 1;
+
+	if ((env = getenv("XRANDR_SETUP_MOCK_LATENCY")))
+		latency = strtol(env, NULL, 10);
+
+	if (!(path = getenv("XRANDR_SETUP_MOCK")) || !(fp = fopen(path, "r"))) {
+		fprintf(stderr, "mock: no topology, set XRANDR_SETUP_MOCK to one\n");
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), fp))
+		parseline(line);
+	fclose(fp);
+}
+
+static void
+parseline(char *line)
+{
+	MockOutput *o;
+	MockCrtc *c;
+	XRRModeInfo *m;
+	char *save;
+	char *kind;
+	char *arg;
+	char *end;
+	char letters[4];
+	unsigned long first;
+	unsigned long last;
+	unsigned int width;
+	unsigned int height;
+	unsigned int product;
+	unsigned int serial;
+	unsigned int vendor;
+	double rate;
+	int index;
+	int x;
+	int y;
+	int len;
+
+	line[strcspn(line, "#\n")] = '\0';
+	if (!(kind = strtok_r(line, " \t", &save)))
+		return;
+
+	if (!strcmp(kind, "mode")) {
+		if (sscanf(save, "%u %u %lf", &width, &height, &rate) != 3)
+			return;
+		modes = grow(modes, (size_t) nmode, sizeof(XRRModeInfo));
+		m = &modes[nmode];
+		memset(m, 0, sizeof(*m));
+		m->id = MODE_BASE + nmode++;
+		m->width = width;
+		m->height = height;
+		m->hTotal = width + 160;
+		m->vTotal = height + 40;
+		m->dotClock = (unsigned long) (rate * m->hTotal * m->vTotal + 0.5);
+	} else if (!strcmp(kind, "crtc")) {
+		crtcs = grow(crtcs, (size_t) ncrtc, sizeof(MockCrtc));
+		memset(&crtcs[ncrtc++], 0, sizeof(MockCrtc));
+	} else if (!strcmp(kind, "output")) {
+		outputs = grow(outputs, (size_t) noutput, sizeof(MockOutput));
+		o = &outputs[noutput++];
+		memset(o, 0, sizeof(*o));
+		if (!(arg = strtok_r(NULL, " \t", &save)) || !(o->name = strdup(arg))) {
+			fprintf(stderr, "mock: output without a name\n");
+			exit(1);
+		}
+		o->connected = (arg = strtok_r(NULL, " \t", &save)) && !strcmp(arg, "connected");
+		while ((arg = strtok_r(NULL, " \t", &save))) {
+			first = last = strtoul(arg, &end, 10);
+			if (*end == '-')
+				last = strtoul(end + 1, NULL, 10);
+			for (; first <= last; first++)
+				addmode(o, first);
+		}
+	} else if (!strcmp(kind, "edid")) {
+		if (sscanf(save, "%d %3[A-Z] %x %x", &index, letters, &product, &serial) != 4 || index < 1 || index > noutput)
+			return;
+		o = &outputs[index - 1];
+		vendor = (unsigned int) ((letters[0] - '@') << 10 | (letters[1] - '@') << 5 | (letters[2] - '@'));
+		o->edid[0] = vendor >> 8;
+		o->edid[1] = vendor & 0xff;
+		o->edid[2] = product & 0xff;
+		o->edid[3] = product >> 8 & 0xff;
+		for (int i = 0; i < 4; i++)
+			o->edid[4 + i] = serial >> (8 * i) & 0xff;
+		o->hasedid = 1;
+	} else if (!strcmp(kind, "lit")) {
+		if (sscanf(save, "%d %lu %d %d%n", &index, &first, &x, &y, &len) != 4 || index < 1 || index > ncrtc
+		    || !getmode(MODE_BASE + first - 1))
+			return;
+		c = &crtcs[index - 1];
+		c->x = x;
+		c->y = y;
+		c->mode = MODE_BASE + first - 1;
+		c->rotation = RR_Rotate_0;
+		for (arg = strtok_r(save + len, " \t", &save); arg; arg = strtok_r(NULL, " \t", &save)) {
+			if ((index = atoi(arg)) < 1 || index > noutput)
+				continue;
+			c->outputs = grow(c->outputs, (size_t) c->noutput, sizeof(RROutput));
+			c->outputs[c->noutput++] = OUTPUT_BASE + index - 1;
+			outputs[index - 1].crtc = CRTC_BASE + (RRCrtc) (c - crtcs);
+		}
+	} else if (!strcmp(kind, "primary")) {
+		if ((index = atoi(save)) >= 1 && index <= noutput)
+			primary = OUTPUT_BASE + index - 1;
+	} else if (!strcmp(kind, "screen")) {
+		sscanf(save, "%d %d %d %d", &screen.width, &screen.height, &screen.mwidth, &screen.mheight);
+	} else if (!strcmp(kind, "provider")) {
+		providers = grow(providers, (size_t) nprovider, sizeof(MockProvider));
+		if (!(arg = strtok_r(NULL, " \t", &save)) || !(providers[nprovider].name = strdup(arg)))
+			return;
+		providers[nprovider++].source = None;
+	} else {
+		fprintf(stderr, "mock: unknown item: %s\n", kind);
+	}
+}
+
+/* a request waiting for its reply, the latency is paid once for it */
+static void
+roundtrip(Display *d)
+{
+	struct timespec ts;
+
+	sendrequest(d);
+	if (latency <= 0)
+		return;
+
+	ts.tv_sec = latency / 1000000;
+	ts.tv_nsec = latency % 1000000 * 1000;
+	while (nanosleep(&ts, &ts) < 0)
+		;
+}
+
+static void
+sendrequest(Display *d)
+{
+	((_XPrivDisplay) d)->request++;
+}
+
+Display*
+XOpenDisplay(const char *name)
+{
+	_XPrivDisplay d;
+	int fd[2];
+
+	load();
+	if (!(d = calloc(1, sizeof(*d))))
+		return NULL;
+
+	/* never readable, no event ever comes */
+	if (pipe(fd) < 0) {
+		free(d);
+		return NULL;
+	}
+	d->fd = fd[0];
+	d->nscreens = 1;
+	d->screens = &screen;
+	if (!(d->display_name = strdup(name ? name : getenv("DISPLAY") ? getenv("DISPLAY") : ":0"))) {
+		free(d);
+		return NULL;
+	}
+	roundtrip((Display*) d);
+
+	return (Display*) d;
+}
+
+int
+XCloseDisplay(Display *d)
+{
+	close(ConnectionNumber(d));
+	free(DisplayString(d));
+	free(d);
+	return 0;
+}
+
+Window
+XDefaultRootWindow(Display *d)
+{
+	(void) d;
+	return 1;
+}
+
+int
+XFlush(Display *d)
+{
+	(void) d;
+	return 1;
+}
+
+int
+XFree(void *data)
+{
+	free(data);
+	return 1;
+}
+
+int
+XGrabServer(Display *d)
+{
+	sendrequest(d);
+	return 1;
+}
+
+Atom
+XInternAtom(Display *d, const char *name, Bool onlyifexists)
+{
+	(void) onlyifexists;
+
+	roundtrip(d);
+	return strcmp(name, "EDID") ? None : EDID_ATOM;
+}
+
+int
+XNextEvent(Display *d, XEvent *ev)
+{
+	(void) d;
+
+	/* XPending() never has any, it is not called */
+	memset(ev, 0, sizeof(*ev));
+	return 0;
+}
+
+int
+XPending(Display *d)
+{
+	(void) d;
+	return 0;
+}
+
+XErrorHandler
+XSetErrorHandler(XErrorHandler h)
+{
+	XErrorHandler prev = handler;
+
+	handler = h;
+	return prev;
+}
+
+int
+XSync(Display *d, Bool discard)
+{
+	(void) discard;
+
+	roundtrip(d);
+	return 1;
+}
+
+int
+XUngrabServer(Display *d)
+{
+	sendrequest(d);
+	return 1;
+}
+
+void
+XRRFreeCrtcInfo(XRRCrtcInfo *info)
+{
+	if (!info)
+		return;
+	free(info->outputs);
+	free(info->possible);
+	free(info);
+}
+
+void
+XRRFreeOutputInfo(XRROutputInfo *info)
+{
+	if (!info)
+		return;
+	free(info->name);
+	free(info->crtcs);
+	free(info->clones);
+	free(info->modes);
+	free(info);
+}
+
+void
+XRRFreeProviderInfo(XRRProviderInfo *info)
+{
+	if (!info)
+		return;
+	free(info->name);
+	free(info->crtcs);
+	free(info->outputs);
+	free(info->associated_providers);
+	free(info->associated_capability);
+	free(info);
+}
+
+void
+XRRFreeProviderResources(XRRProviderResources *res)
+{
+	if (!res)
+		return;
+	free(res->providers);
+	free(res);
+}
+
+void
+XRRFreeScreenResources(XRRScreenResources *res)
+{
+	if (!res)
+		return;
+	free(res->crtcs);
+	free(res->outputs);
+	free(res->modes);
+	free(res);
+}
+
+XRRCrtcInfo*
+XRRGetCrtcInfo(Display *d, XRRScreenResources *res, RRCrtc id)
+{
+	XRRCrtcInfo *info;
+	XRRModeInfo *m;
+	MockCrtc *c;
+	(void) res;
+
+	roundtrip(d);
+	if (!(c = getcrtc(id)) || !(info = calloc(1, sizeof(*info))))
+		return NULL;
+
+	info->timestamp = configtime;
+	info->x = c->x;
+	info->y = c->y;
+	if ((m = getmode(c->mode))) {
+		info->width = c->rotation & (RR_Rotate_90 | RR_Rotate_270) ? m->height : m->width;
+		info->height = c->rotation & (RR_Rotate_90 | RR_Rotate_270) ? m->width : m->height;
+	}
+	info->mode = c->mode;
+	info->rotation = c->rotation ? c->rotation : RR_Rotate_0;
+	info->rotations = RR_Rotate_0 | RR_Rotate_90 | RR_Rotate_180 | RR_Rotate_270;
+	info->noutput = c->noutput;
+	if (!(info->outputs = calloc((size_t) c->noutput + 1, sizeof(RROutput)))
+	    || !(info->possible = calloc(1, sizeof(RROutput)))) {
+		XRRFreeCrtcInfo(info);
+		return NULL;
+	}
+	memcpy(info->outputs, c->outputs, (size_t) c->noutput * sizeof(RROutput));
+
+	return info;
+}
+
+XRROutputInfo*
+XRRGetOutputInfo(Display *d, XRRScreenResources *res, RROutput id)
+{
+	XRROutputInfo *info;
+	MockOutput *o;
+	(void) res;
+
+	roundtrip(d);
+	if (!(o = getoutput(id)) || !(info = calloc(1, sizeof(*info))))
+		return NULL;
+
+	info->timestamp = configtime;
+	info->crtc = o->crtc;
+	info->connection = o->connected ? RR_Connected : RR_Disconnected;
+	info->nameLen = (int) strlen(o->name);
+	info->ncrtc = ncrtc;
+	info->nmode = o->nmode;
+	info->npreferred = o->nmode ? 1 : 0;
+	if (!(info->name = strdup(o->name)) || !(info->crtcs = calloc((size_t) ncrtc + 1, sizeof(RRCrtc)))
+	    || !(info->clones = calloc(1, sizeof(RROutput)))
+	    || !(info->modes = calloc((size_t) o->nmode + 1, sizeof(RRMode)))) {
+		XRRFreeOutputInfo(info);
+		return NULL;
+	}
+	for (int i = 0; i < ncrtc; i++)
+		info->crtcs[i] = CRTC_BASE + i;
+	memcpy(info->modes, o->modes, (size_t) o->nmode * sizeof(RRMode));
+
+	return info;
+}
+
+RROutput
+XRRGetOutputPrimary(Display *d, Window window)
+{
+	(void) window;
+
+	roundtrip(d);
+	return primary;
+}
+
+int
+XRRGetOutputProperty(Display *d, RROutput id, Atom property, long offset, long length, Bool delete,
+                     Bool pending, Atom type, Atom *actualtype, int *actualformat, unsigned long *nitems,
+                     unsigned long *bytesafter, unsigned char **prop)
+{
+	MockOutput *o;
+	long start;
+	long n;
+	(void) delete;
+	(void) pending;
+	(void) type;
+
+	roundtrip(d);
+	*actualtype = None;
+	*actualformat = 0;
+	*nitems = 0;
+	*bytesafter = 0;
+	*prop = NULL;
+	if (!(o = getoutput(id)) || property != EDID_ATOM || !o->hasedid)
+		return 0;
+
+	/* only the bytes from 8 to 15 are recorded, the others read as zero */
+	start = offset * 4;
+	n = length * 4;
+	if (start < 0 || n < 0 || start > 128)
+		return 0;
+	if (start + n > 128)
+		n = 128 - start;
+	if (!(*prop = calloc((size_t) n + 1, 1)))
+		return 0;
+	for (long i = 0; i < n; i++) {
+		if (start + i >= 8 && start + i < 16)
+			(*prop)[i] = o->edid[start + i - 8];
+	}
+	*actualtype = XA_INTEGER;
+	*actualformat = 8;
+	*nitems = (unsigned long) n;
+	*bytesafter = (unsigned long) (128 - start - n);
+
+	return 0;
+}
+
+XRRProviderInfo*
+XRRGetProviderInfo(Display *d, XRRScreenResources *res, RRProvider id)
+{
+	XRRProviderInfo *info;
+	MockProvider *p;
+	(void) res;
+
+	roundtrip(d);
+	if (id < PROVIDER_BASE || id >= (RRProvider) PROVIDER_BASE + nprovider || !(info = calloc(1, sizeof(*info))))
+		return NULL;
+	p = &providers[id - PROVIDER_BASE];
+
+	info->capabilities = RR_Capability_SourceOutput | RR_Capability_SinkOutput;
+	info->nameLen = (int) strlen(p->name);
+	info->nassociatedproviders = p->source != None;
+	if (!(info->name = strdup(p->name)) || !(info->associated_providers = calloc(2, sizeof(RRProvider)))
+	    || !(info->associated_capability = calloc(2, sizeof(unsigned int)))) {
+		XRRFreeProviderInfo(info);
+		return NULL;
+	}
+	info->associated_providers[0] = p->source;
+	info->associated_capability[0] = RR_Capability_SinkOutput;
+
+	return info;
+}
+
+XRRProviderResources*
+XRRGetProviderResources(Display *d, Window window)
+{
+	XRRProviderResources *res;
+	(void) window;
+
+	roundtrip(d);
+	if (!(res = calloc(1, sizeof(*res))) || !(res->providers = calloc((size_t) nprovider + 1, sizeof(RRProvider)))) {
+		free(res);
+		return NULL;
+	}
+	res->timestamp = configtime;
+	res->nproviders = nprovider;
+	for (int i = 0; i < nprovider; i++)
+		res->providers[i] = PROVIDER_BASE + i;
+
+	return res;
+}
+
+XRRScreenResources*
+XRRGetScreenResources(Display *d, Window window)
+{
+	XRRScreenResources *res;
+	(void) window;
+
+	roundtrip(d);
+	if (!(res = calloc(1, sizeof(*res))) || !(res->crtcs = calloc((size_t) ncrtc + 1, sizeof(RRCrtc)))
+	    || !(res->outputs = calloc((size_t) noutput + 1, sizeof(RROutput)))
+	    || !(res->modes = calloc((size_t) nmode + 1, sizeof(XRRModeInfo)))) {
+		XRRFreeScreenResources(res);
+		return NULL;
+	}
+
+	res->timestamp = configtime;
+	res->configTimestamp = configtime;
+	res->ncrtc = ncrtc;
+	res->noutput = noutput;
+	res->nmode = nmode;
+	for (int i = 0; i < ncrtc; i++)
+		res->crtcs[i] = CRTC_BASE + i;
+	for (int i = 0; i < noutput; i++)
+		res->outputs[i] = OUTPUT_BASE + i;
+	memcpy(res->modes, modes, (size_t) nmode * sizeof(XRRModeInfo));
+
+	return res;
+}
+
+/* the server polls nothing, both are the same */
+XRRScreenResources*
+XRRGetScreenResourcesCurrent(Display *d, Window window)
+{
+	return XRRGetScreenResources(d, window);
+}
+
+Bool
+XRRQueryExtension(Display *d, int *eventbase, int *errorbase)
+{
+	roundtrip(d);
+	*eventbase = EVENT_BASE;
+	*errorbase = 0;
+	return True;
+}
+
+void
+XRRSelectInput(Display *d, Window window, int mask)
+{
+	(void) window;
+	(void) mask;
+
+	sendrequest(d);
+}
+
+/* a failed request is reported to the error handler, as a server would once synced */
+Status
+XRRSetCrtcConfig(Display *d, XRRScreenResources *res, RRCrtc id, Time timestamp, int x, int y, RRMode mode,
+                 Rotation rotation, RROutput *outs, int nouts)
+{
+	XErrorEvent ee;
+	MockCrtc *c;
+	int valid;
+	(void) res;
+	(void) timestamp;
+
+	roundtrip(d);
+	valid = (c = getcrtc(id)) && (mode == None ? !nouts : getmode(mode) && nouts > 0);
+	for (int i = 0; valid && i < nouts; i++)
+		valid = getoutput(outs[i]) != NULL;
+	if (!valid) {
+		memset(&ee, 0, sizeof(ee));
+		ee.type = 0;
+		ee.display = d;
+		ee.error_code = BadValue;
+		ee.request_code = EVENT_BASE;
+		if (handler)
+			handler(d, &ee);
+		return RRSetConfigFailed;
+	}
+
+	for (int i = 0; i < c->noutput; i++)
+		getoutput(c->outputs[i])->crtc = None;
+	c->outputs = grow(c->outputs, (size_t) nouts, sizeof(RROutput));
+	memcpy(c->outputs, outs, (size_t) nouts * sizeof(RROutput));
+	c->noutput = nouts;
+	for (int i = 0; i < nouts; i++)
+		getoutput(outs[i])->crtc = id;
+	c->x = x;
+	c->y = y;
+	c->mode = mode;
+	c->rotation = rotation;
+
+	return RRSetConfigSuccess;
+}
+
+void
+XRRSetOutputPrimary(Display *d, Window window, RROutput output)
+{
+	(void) window;
+
+	sendrequest(d);
+	primary = output;
+}
+
+/* linking providers makes a server reconfigure, which bumps the config timestamp */
+int
+XRRSetProviderOutputSource(Display *d, XID provider, XID source)
+{
+	sendrequest(d);
+	if (provider >= PROVIDER_BASE && provider < (XID) PROVIDER_BASE + nprovider) {
+		providers[provider - PROVIDER_BASE].source = source;
+		configtime++;
+	}
+	return 0;
+}
+
+void
+XRRSetScreenSize(Display *d, Window window, int width, int height, int mmwidth, int mmheight)
+{
+	(void) window;
+
+	/* no event ever comes, so the size is reported right away */
+	sendrequest(d);
+	screen.width = width;
+	screen.height = height;
+	screen.mwidth = mmwidth;
+	screen.mheight = mmheight;
+}
+
+int
+XRRUpdateConfiguration(XEvent *ev)
+{
+	(void) ev;
+	return 1;
+}
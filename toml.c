@@ -1,178 +1,360 @@
 #define _POSIX_C_SOURCE 200809L
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <sys/stat.h>
 #include "toml.h"
 
 #define STR_SIZE 512
-
-static TomlArray* appendarraykey(TomlArray *arr, const char *key);
-static int addkeyval(TomlArray *arr, const char *str);
-static TomlArray* createarray(TomlArray *parent);
-static TomlArrayKey* createarraykey(const char *key);
-static TomlKeyVal *createkeyval(const char *key, const char *val);
-static void deletekeyval(TomlKeyVal *item);
-static TomlArray* findparent(TomlArray *current, const char *key);
-static int parsebool(TomlKeyVal *item, unsigned int *ret);
-static int parsedouble(TomlKeyVal *item, double *ret);
-static int parsestring(TomlKeyVal *item, char **ret);
-static int parseuint(TomlKeyVal *item, unsigned int *ret);
+#define BLOCK_SIZE 4096
+
+typedef union {
+	void *p;
+	double d;
+	size_t s;
+} TomlAlign;
+
+typedef struct TomlBlock TomlBlock;
+
+struct TomlBlock {
+	TomlBlock *next;
+	size_t size;
+	size_t used;
+	TomlAlign data[];
+};
+
+/* owns every node of a document, released at once by tomldeletearray() */
+struct TomlArena {
+	TomlBlock *block;
+	char *buf;
+	size_t len;
+
+	/* where parsing stopped and the array the next items go in */
+	size_t off;
+	TomlArray *cur;
+
+	/* the keys of the arrays that are always top level, terminated by NULL */
+	const char **roots;
+
+	/* the interned keys, slots hold ids and ids - 1 index keys */
+	TomlView *keys;
+	size_t nkey;
+	size_t capkey;
+	unsigned int *slots;
+	size_t nslot;
+};
+
+static TomlArray* appendarraykey(TomlArray *arr, TomlView key);
+static int addkeyval(TomlArray *arr, TomlView line);
+static void* arenaalloc(TomlArena *arena, size_t size);
+static void* arenagrow(TomlArena *arena, void *vec, size_t n, size_t *cap, size_t size);
+static TomlArray* createarray(TomlArray *parent, TomlArena *arena);
+static TomlArray* findparent(TomlArray *current, TomlView key);
+static TomlKeyVal* finditem(TomlArray *arr, const char *key);
+static size_t findslot(const TomlArena *arena, const char *key, size_t len);
+static void freearena(TomlArena *arena);
+static int growslots(TomlArena *arena);
+static unsigned int internkey(TomlArena *arena, TomlView key);
+static int parse(TomlArray *root, const char *key, TomlArray **ret);
+static int parsebool(const char *buf, TomlView val, unsigned int *ret);
+static int parsedouble(const char *buf, TomlView val, double *ret);
+static int parseenum(const char *buf, TomlView val, const TomlEnum *enums, unsigned int *ret);
+static int parsefield(const char *buf, TomlView val, const TomlField *field, void *ret);
+static int parsestring(const char *buf, TomlView val, char **ret);
+static int parseuint(const char *buf, TomlView val, unsigned int *ret);
+static char* readfile(FILE *fp, size_t *len);
+static TomlView trimview(const char *buf, size_t start, size_t end);
+static int viewcmp(const char *buf, TomlView view, const char *str, size_t len);
 
 static TomlArray*
-appendarraykey(TomlArray *arr, const char *key)
+appendarraykey(TomlArray *arr, TomlView key)
 {
-	TomlArrayKey *keyarr;
+	TomlArrayKey *keyarr = NULL;
 
-	for (size_t i = 0; i < arr->nkey; i++) {
-		keyarr = arr->key[i];
-		if (!strcmp(key, keyarr->key)) {
-			TomlArray **newarr;
-			TomlArray *newarrelem;
-
-			keyarr->narr++;
-			if (!(newarr = realloc(keyarr->arr, keyarr->narr * sizeof(TomlArray*))))
-				return NULL;
-			keyarr->arr = newarr;
-			
-			if (!(newarrelem = createarray(arr)))
-				return NULL;
-			keyarr->arr[keyarr->narr - 1] = newarrelem;
-
-			return keyarr->arr[keyarr->narr - 1];
-		}
+	for (size_t i = 0; i < arr->nkey && !keyarr; i++) {
+		if (!viewcmp(arr->buf, arr->key[i].key, arr->buf + key.off, key.len))
+			keyarr = &arr->key[i];
 	}
 
-	TomlArrayKey **newkeys;
-
-	arr->nkey++;
-	if (!(newkeys = realloc(arr->key, arr->nkey * sizeof(TomlArrayKey*))))
-		return NULL;
-	arr->key = newkeys;
+	if (!keyarr) {
+		if (!(arr->key = arenagrow(arr->arena, arr->key, arr->nkey, &arr->capkey, sizeof(TomlArrayKey))))
+			return NULL;
 
-	if (!(keyarr = createarraykey(key)))
-		return NULL;
-	arr->key[arr->nkey - 1] = keyarr;
+		keyarr = &arr->key[arr->nkey++];
+		keyarr->key = key;
+		keyarr->arr = NULL;
+		keyarr->narr = 0;
+		keyarr->caparr = 0;
+	}
 
-	keyarr->narr = 1;
-	if (!(keyarr->arr = malloc(sizeof(TomlArray*))))
+	if (!(keyarr->arr = arenagrow(arr->arena, keyarr->arr, keyarr->narr, &keyarr->caparr, sizeof(TomlArray*))))
 		return NULL;
-	
-	if (!(keyarr->arr[0] = createarray(arr)))
+	if (!(keyarr->arr[keyarr->narr] = createarray(arr, arr->arena)))
 		return NULL;
 
-	return keyarr->arr[0];
+	return keyarr->arr[keyarr->narr++];
 }
 
 static int
-addkeyval(TomlArray *arr, const char *str)
+addkeyval(TomlArray *arr, TomlView line)
 {
-	char key[1024];
-	char val[1024];
-	char *ptr;
+	const char *ptr;
+	size_t eq;
 
-	if (!(ptr = strchr(str, '=')))
+	if (!(ptr = memchr(arr->buf + line.off, '=', line.len)))
 		return 1;
+	eq = ptr - arr->buf;
 
-	strcpy(val, (ptr + 1));
-	strncpy(key, str, ptr - str + 1);
-	key[ptr - str] = '\0';
-
-	arr->nitem++;
-	arr->item = realloc(arr->item, arr->nitem * sizeof(TomlKeyVal));
-	if (!arr->item)
+	if (!(arr->item = arenagrow(arr->arena, arr->item, arr->nitem, &arr->capitem, sizeof(TomlKeyVal))))
 		return 1;
 
-	arr->item[arr->nitem - 1] = createkeyval(key, val);
+	arr->item[arr->nitem].key = trimview(arr->buf, line.off, eq);
+	arr->item[arr->nitem].val = trimview(arr->buf, eq + 1, line.off + line.len);
+	if (!(arr->item[arr->nitem].id = internkey(arr->arena, arr->item[arr->nitem].key)))
+		return 1;
+	arr->nitem++;
 	return 0;
 }
 
+/* returns size bytes of the arena, blocks double in size as they fill up */
+static void*
+arenaalloc(TomlArena *arena, size_t size)
+{
+	TomlBlock *block = arena->block;
+	void *ret;
+
+	size = (size + sizeof(TomlAlign) - 1) / sizeof(TomlAlign) * sizeof(TomlAlign);
+
+	if (!block || block->size - block->used < size) {
+		size_t bsize = block ? block->size * 2 : BLOCK_SIZE;
+
+		while (bsize < size)
+			bsize *= 2;
+		if (!(block = malloc(sizeof(TomlBlock) + bsize)))
+			return NULL;
+
+		block->next = arena->block;
+		block->size = bsize;
+		block->used = 0;
+		arena->block = block;
+	}
+
+	ret = (char*) block->data + block->used;
+	block->used += size;
+	return ret;
+}
+
+/*
+ * makes room for one more element in vec, doubling its capacity when it
+ * is full. The old vector is left in the arena, so a vector never costs
+ * more than twice its final size.
+ */
+static void*
+arenagrow(TomlArena *arena, void *vec, size_t n, size_t *cap, size_t size)
+{
+	void *ret;
+
+	if (n < *cap)
+		return vec;
+
+	if (!(ret = arenaalloc(arena, (*cap ? *cap * 2 : 4) * size)))
+		return NULL;
+	if (n)
+		memcpy(ret, vec, n * size);
+
+	*cap = *cap ? *cap * 2 : 4;
+	return ret;
+}
+
 static TomlArray*
-createarray(TomlArray *parent)
+createarray(TomlArray *parent, TomlArena *arena)
 {
 	TomlArray *ret;
 
-	if (!(ret = malloc(sizeof(TomlArray))))
+	if (!(ret = arenaalloc(arena, sizeof(TomlArray))))
 		return NULL;
-	
+
 	ret->parentarr = parent;
+	ret->buf = arena->buf;
+	ret->arena = arena;
 	ret->nitem = 0;
 	ret->nkey = 0;
+	ret->capitem = 0;
+	ret->capkey = 0;
 	ret->item = NULL;
 	ret->key = NULL;
 
 	return ret;
 }
 
-static TomlArrayKey*
-createarraykey(const char *key)
+static TomlArray*
+findparent(TomlArray *arr, TomlView key)
 {
-	TomlArrayKey *ret;
+	TomlArray *ptr;
 
-	if (!(ret = malloc(sizeof(TomlArrayKey))))
-		return NULL;
-	
-	ret->key = strdup(key);
-	ret->narr = 0;
-	ret->arr = NULL;
+	if (!arr->parentarr)
+		return arr;
 
-	return ret;
+	/* a top level array is never nested in the table before it */
+	for (const char **root = arr->arena->roots; root && *root; root++) {
+		if (!viewcmp(arr->buf, key, *root, strlen(*root))) {
+			for (ptr = arr; ptr->parentarr; ptr = ptr->parentarr)
+				;
+			return ptr;
+		}
+	}
+
+	for (ptr = arr->parentarr; ptr != NULL; ptr = ptr->parentarr) {
+		for (size_t i = 0; i < ptr->nkey; i++) {
+			if (!viewcmp(arr->buf, ptr->key[i].key, arr->buf + key.off, key.len))
+				return ptr;
+		}
+	}
+
+	return arr;
 }
 
 static TomlKeyVal*
-createkeyval(const char *key, const char *val)
+finditem(TomlArray *arr, const char *key)
 {
-	TomlKeyVal *ret = NULL;
+	size_t len = strlen(key);
 
-	ret = malloc(sizeof(TomlKeyVal));
-	if (!ret)
-		return NULL;
+	for (size_t i = 0; i < arr->nitem; i++) {
+		if (!viewcmp(arr->buf, arr->item[i].key, key, len))
+			return &arr->item[i];
+	}
 
-	ret->key = strdup(key);
-	ret->val = strdup(val);
-	return ret;
+	return NULL;
 }
 
+/* returns the slot holding the key, or the empty slot it would go in */
+static size_t
+findslot(const TomlArena *arena, const char *key, size_t len)
+{
+	size_t hash = 2166136261u;
+	size_t slot;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char) key[i];
+		hash *= 16777619u;
+	}
+
+	slot = hash & (arena->nslot - 1);
+	while (arena->slots[slot] && viewcmp(arena->buf, arena->keys[arena->slots[slot] - 1], key, len))
+		slot = (slot + 1) & (arena->nslot - 1);
+
+	return slot;
+}
+
+/* releases the blocks, the buffer and the arena itself */
 static void
-deletekeyval(TomlKeyVal *item)
+freearena(TomlArena *arena)
 {
-	if (!item)
-		return;
-	if (item->key)
-		free(item->key);
-	if (item->val)
-		free(item->val);
-	free(item);
-	item = NULL;
+	TomlBlock *next;
+
+	for (TomlBlock *block = arena->block; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+	free(arena->buf);
+	free(arena);
 }
 
-static TomlArray*
-findparent(TomlArray *arr, const char *key)
+static int
+growslots(TomlArena *arena)
 {
-	TomlArray *ptr;
+	size_t nslot = arena->nslot ? arena->nslot * 2 : 32;
 
-	if (!arr->parentarr)
-		return arr;
+	if (!(arena->slots = arenaalloc(arena, nslot * sizeof(unsigned int))))
+		return 1;
+	memset(arena->slots, 0, nslot * sizeof(unsigned int));
+	arena->nslot = nslot;
 
-	for (ptr = arr->parentarr; ptr != NULL; ptr = ptr->parentarr) {
-		for (size_t i = 0; i < ptr->nkey; i++) {
-			if (!strcmp(ptr->key[i]->key, key))
-				return ptr;
+	for (size_t i = 0; i < arena->nkey; i++)
+		arena->slots[findslot(arena, arena->buf + arena->keys[i].off, arena->keys[i].len)] = i + 1;
+
+	return 0;
+}
+
+/* returns the id of the key, the same for every equal key of the document, 0 on failure */
+static unsigned int
+internkey(TomlArena *arena, TomlView key)
+{
+	size_t slot;
+
+	if (arena->nkey * 2 >= arena->nslot && growslots(arena))
+		return 0;
+
+	slot = findslot(arena, arena->buf + key.off, key.len);
+	if (!arena->slots[slot]) {
+		if (!(arena->keys = arenagrow(arena, arena->keys, arena->nkey, &arena->capkey, sizeof(TomlView))))
+			return 0;
+		arena->keys[arena->nkey++] = key;
+		arena->slots[slot] = arena->nkey;
+	}
+
+	return arena->slots[slot];
+}
+
+/*
+ * parses the document from where it stopped. With a key it stops before
+ * the second top level [[key]] table, setting ret to the first one, which
+ * is NULL when none is left. Returns 1 on a malformed document.
+ */
+static int
+parse(TomlArray *root, const char *key, TomlArray **ret)
+{
+	TomlArena *arena = root->arena;
+	const char *buf = arena->buf;
+	const char *end;
+	TomlView line;
+	size_t next;
+
+	*ret = NULL;
+
+	for (; arena->off < arena->len; arena->off = next) {
+		if (!(end = memchr(buf + arena->off, '\n', arena->len - arena->off)))
+			end = buf + arena->len;
+		next = end - buf + (end < buf + arena->len);
+
+		line = trimview(buf, arena->off, end - buf);
+
+		if (!line.len || buf[line.off] == '#')
+			continue;
+
+		const char *ptr = buf + line.off;
+
+		if (line.len >= 4 && ptr[0] == '[' && ptr[1] == '[' && ptr[line.len - 1] == ']' && ptr[line.len - 2] == ']') {
+			TomlView name = trimview(buf, line.off + 2, line.off + line.len - 2);
+			TomlArray *parent = findparent(arena->cur, name);
+			int block = key && parent == root && !viewcmp(buf, name, key, strlen(key));
+
+			if (block && *ret)
+				return 0;
+			if (!(arena->cur = appendarraykey(parent, name)))
+				return 1;
+			if (block)
+				*ret = arena->cur;
+			continue;
 		}
+		if (addkeyval(arena->cur, line))
+			return 1;
 	}
 
-	return arr;
+	return 0;
 }
 
 static int
-parsebool(TomlKeyVal *item, unsigned int *ret)
+parsebool(const char *buf, TomlView val, unsigned int *ret)
 {
-	if (!strcmp(item->val, "true") || !strcmp(item->val, "True")) {
+	if (!viewcmp(buf, val, "true", 4) || !viewcmp(buf, val, "True", 4)) {
 		*ret = 1;
 		return 0;
 	}
 
-	if (!strcmp(item->val, "false") || !strcmp(item->val, "False")) {
+	if (!viewcmp(buf, val, "false", 5) || !viewcmp(buf, val, "False", 5)) {
 		*ret = 0;
 		return 0;
 	}
@@ -180,43 +362,43 @@ parsebool(TomlKeyVal *item, unsigned int *ret)
 }
 
 static int
-parsedouble(TomlKeyVal *item, double *ret)
+parsedouble(const char *buf, TomlView val, double *ret)
 {
-	char *ptr;
-	unsigned int sep = 0;
+	const char *start = buf + val.off;
+	size_t i = val.len && start[0] == '-';
+	char *end;
+	double d;
 
-	for (ptr = (char*) item->val; *ptr != '\0'; ptr++) {
-		if (*ptr <= '9' && *ptr >= '0')
-			continue;
-		if (*ptr == '.') {
-			sep++;
-			if (ptr != (char*) item->val && sep <= 1
-			    && (*(ptr + 1) <= '9' && *(ptr + 1) >= '0')
-			    && (*(ptr - 1) <= '9' && *(ptr - 1) >= '0'))
-				continue;
-		}
-		if (*ptr == '-' && ptr == (char*) item->val)
-			continue;
+	/* a digit first keeps strtod() from accepting inf, nan or whitespace */
+	if (i >= val.len || start[i] > '9' || start[i] < '0')
 		return 1;
+
+	/* and only decimal digits, a point and an exponent, strtod() also takes hex */
+	for (; i < val.len; i++) {
+		if (!isdigit((unsigned char) start[i]) && !strchr(".eE+-", start[i]))
+			return 1;
 	}
 
-	sscanf(item->val, "%lf", ret);
+	/* the view always ends before whitespace or the terminating nul */
+	d = strtod(start, &end);
+	if (end != start + val.len)
+		return 1;
+
+	*ret = d;
 	return 0;
 }
 
 static int
-parsestring(TomlKeyVal *item, char **ret)
+parseenum(const char *buf, TomlView val, const TomlEnum *enums, unsigned int *ret)
 {
-	char *ptr;
-	char *temp;
+	const char *start = buf + val.off;
 
-	temp = strdup(item->val);
-	ptr = strchr(temp, '\0');
+	if (val.len < 2 || start[0] != '"' || start[val.len - 1] != '"' || !enums)
+		return 1;
 
-	if (*(--ptr) == '"') {
-		*ptr = '\0';
-		if (*temp == '"') {
-			*ret = strdup(temp + 1);
+	for (; enums->name; enums++) {
+		if (strlen(enums->name) == val.len - 2 && !memcmp(enums->name, start + 1, val.len - 2)) {
+			*ret = enums->value;
 			return 0;
 		}
 	}
@@ -224,67 +406,165 @@ parsestring(TomlKeyVal *item, char **ret)
 }
 
 static int
-parseuint(TomlKeyVal *item, unsigned int *ret)
+parsefield(const char *buf, TomlView val, const TomlField *field, void *ret)
+{
+	switch (field->type) {
+	case TOML_BOOL:
+		return parsebool(buf, val, ret);
+	case TOML_DOUBLE:
+		return parsedouble(buf, val, ret);
+	case TOML_ENUM:
+		return parseenum(buf, val, field->enums, ret);
+	case TOML_STRING:
+		return parsestring(buf, val, ret);
+	case TOML_UINT:
+		return parseuint(buf, val, ret);
+	}
+	return 1;
+}
+
+static int
+parsestring(const char *buf, TomlView val, char **ret)
 {
-	char *ptr;
+	const char *start = buf + val.off;
 
-	for (ptr = (char*) item->val; *ptr != '\0'; ptr++) {
+	if (val.len < 2 || start[0] != '"' || start[val.len - 1] != '"')
+		return 1;
+
+	if (!(*ret = strndup(start + 1, val.len - 2)))
+		return 1;
+	return 0;
+}
+
+static int
+parseuint(const char *buf, TomlView val, unsigned int *ret)
+{
+	const char *ptr;
+	const char *start = buf + val.off;
+	unsigned int n = 0;
+
+	if (!val.len)
+		return 1;
+
+	for (ptr = start; ptr < start + val.len; ptr++) {
 		if (*ptr > '9' || *ptr < '0')
 			return 1;
+		if (n > (UINT_MAX - (unsigned int) (*ptr - '0')) / 10)
+			return 1;
+		n = n * 10 + (unsigned int) (*ptr - '0');
 	}
 
-	sscanf(item->val, "%u", ret);
+	*ret = n;
 	return 0;
 }
 
-static void
-trimwhitespace(char *str)
+/*
+ * reads the whole stream into one nul terminated buffer. Regular files
+ * are sized up front so their contents arrive in a single read.
+ */
+static char*
+readfile(FILE *fp, size_t *len)
 {
-	char *end;
-	char *original = str;
+	struct stat st;
+	size_t size = STR_SIZE;
+	size_t n;
+	char *buf;
+	char *newbuf;
 
-	while(isspace((unsigned char)*str)) str++;
+	if (!fstat(fileno(fp), &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+		size = (size_t) st.st_size;
 
-	if(*str == 0) {
-		*original = '\0';
-		return;
-	}
+	if (!(buf = malloc(size + 1)))
+		return NULL;
 
-	end = str + strlen(str) - 1;
-	while(end > str && isspace((unsigned char)*end)) end--;
+	*len = 0;
+	while ((n = fread(buf + *len, 1, size + 1 - *len, fp)) > 0) {
+		*len += n;
+		if (*len < size + 1)
+			continue;
 
-	*(end+1) = '\0';
+		size *= 2;
+		if (!(newbuf = realloc(buf, size + 1))) {
+			free(buf);
+			return NULL;
+		}
+		buf = newbuf;
+	}
 
-	if (str != original) {
-		memmove(original, str, end - str + 2); // +2 to include the null terminator
+	if (ferror(fp)) {
+		free(buf);
+		return NULL;
 	}
+
+	buf[*len] = '\0';
+	return buf;
 }
 
+/* returns the span between start and end without surrounding whitespace */
+static TomlView
+trimview(const char *buf, size_t start, size_t end)
+{
+	TomlView ret;
+
+	while (start < end && isspace((unsigned char) buf[start])) start++;
+	while (end > start && isspace((unsigned char) buf[end - 1])) end--;
+
+	ret.off = start;
+	ret.len = end - start;
+	return ret;
+}
+
+static int
+viewcmp(const char *buf, TomlView view, const char *str, size_t len)
+{
+	if (view.len != len)
+		return 1;
+	return memcmp(buf + view.off, str, len);
+}
+
+/* releases the whole document the array belongs to, without walking it */
 void
 tomldeletearray(TomlArray *arr)
 {
-	if (!arr)
-		return;
+	if (arr)
+		freearena(arr->arena);
+}
 
-	for (size_t i = 0; i < arr->nitem; i++)
-		deletekeyval(arr->item[i]);
-	for (size_t i = 0; i < arr->nkey; i++) {
-		for (size_t j = 0; j < arr->key[i]->narr; j++) {
-			tomldeletearray(arr->key[i]->arr[j]);
+/*
+ * fills dest from the options of the array in one pass over its items,
+ * setting the status of every field. Returns the number of invalid fields.
+ */
+int
+tomlextract(TomlArray *arr, TomlField *fields, size_t nfield, void *dest)
+{
+	int ninvalid = 0;
+
+	for (size_t i = 0; i < nfield; i++)
+		fields[i].status = 2;
+
+	for (size_t i = 0; i < arr->nitem; i++) {
+		for (size_t j = 0; j < nfield; j++) {
+			TomlField *f = &fields[j];
+
+			if (f->id != arr->item[i].id || f->status != 2)
+				continue;
+			if ((f->status = parsefield(arr->buf, arr->item[i].val, f, (char*) dest + f->offset)))
+				ninvalid++;
+			break;
 		}
 	}
-	if (arr->key)
-		(free(arr->key));
-	free(arr);
-	arr = NULL;
+
+	return ninvalid;
 }
 
 TomlArrayKey*
 tomlgetarraykey(TomlArray *arr, const char *key)
 {
+	size_t len = strlen(key);
+
 	for (size_t i = 0; i < arr->nkey; i++) {
-		if (!strcmp(arr->key[i]->key, key))
-			return arr->key[i];
+		if (!viewcmp(arr->buf, arr->key[i].key, key, len))
+			return &arr->key[i];
 	}
 
 	return NULL;
@@ -293,90 +573,130 @@ tomlgetarraykey(TomlArray *arr, const char *key)
 int
 tomlgetbool(TomlArray *arr, const char *key, unsigned int *ret)
 {
-	for (size_t i = 0; i < arr->nitem; i++) {
-		if (!strcmp(key, arr->item[i]->key)) {
-			if (parsebool(arr->item[i], ret))
-				return 1;
-			return 0;
-		}
-	}
-	return 2;
+	TomlKeyVal *item;
+
+	if (!(item = finditem(arr, key)))
+		return 2;
+	if (parsebool(arr->buf, item->val, ret))
+		return 1;
+	return 0;
 }
 
+/* parses the whole stream, see tomlopen() */
 TomlArray*
-tomlgetconfig(FILE *fp)
+tomlgetconfig(FILE *fp, const char **roots)
 {
-	char buf[1024];
-	char *ptr;
-	TomlArray *baseptr;
-	TomlArray *arr;
+	TomlArray *root;
 
-	arr = createarray(NULL);
-	baseptr = arr;
-
-	while (fgets(buf, sizeof(buf), fp)) {
-		trimwhitespace(buf);
+	if (!(root = tomlopen(fp, roots)))
+		return NULL;
 
-		if (buf[0] == '#' || buf[0] == '\0')
-			continue;
-		
-		ptr = strchr(buf, '\0');
-
-
-		if (*(buf) == '[' && *(buf + 1) == '[' && *(ptr - 1) == ']' && *(ptr - 2) == ']') {
-			*(ptr - 2) = '\0';
-			ptr = buf + 2;
-			arr = findparent(arr, ptr);
-			if (!(arr = appendarraykey(arr, ptr))) {
-				tomldeletearray(arr);
-				return NULL;
-			}
-			continue;
-		}
-		if (addkeyval(arr, buf)) {
-			tomldeletearray(arr);
-			return NULL;
-		}
+	if (tomlparse(root)) {
+		tomldeletearray(root);
+		return NULL;
 	}
 
-	return baseptr;
+	return root;
 }
 
 int
 tomlgetdouble(TomlArray *arr, const char *key, double *ret)
 {
-	for (size_t i = 0; i < arr->nitem; i++) {
-		if (!strcmp(key, arr->item[i]->key)) {
-			if (parsedouble(arr->item[i], ret))
-				return 1;
-			return 0;
-		}
-	}
-	return 2;
+	TomlKeyVal *item;
+
+	if (!(item = finditem(arr, key)))
+		return 2;
+	if (parsedouble(arr->buf, item->val, ret))
+		return 1;
+	return 0;
 }
 
 int
 tomlgetstring(TomlArray *arr, const char *key, char **ret)
 {
-	for (size_t i = 0; i < arr->nitem; i++) {
-		if (!strcmp(key, arr->item[i]->key)) {
-			if (parsestring(arr->item[i], ret))
-				return 1;
-			return 0;
-		}
-	}
-	return 2;
+	TomlKeyVal *item;
+
+	if (!(item = finditem(arr, key)))
+		return 2;
+	if (parsestring(arr->buf, item->val, ret))
+		return 1;
+	return 0;
 }
 
 int
 tomlgetuint(TomlArray *arr, const char *key, unsigned int *ret)
 {
-	for (size_t i = 0; i < arr->nitem; i++) {
-		if (!strcmp(key, arr->item[i]->key)) {
-			if (parseuint(arr->item[i], ret))
-				return 1;
-			return 0;
-		}
+	TomlKeyVal *item;
+
+	if (!(item = finditem(arr, key)))
+		return 2;
+	if (parseuint(arr->buf, item->val, ret))
+		return 1;
+	return 0;
+}
+
+/*
+ * parses the next top level [[key]] table of the document and everything
+ * in it, returns NULL at the end of the document or if it is malformed
+ */
+TomlArray*
+tomlnext(TomlArray *root, const char *key)
+{
+	TomlArray *ret;
+
+	if (parse(root, key, &ret))
+		return NULL;
+
+	return ret;
+}
+
+/*
+ * reads the stream into the one buffer of the document without parsing
+ * it. Keys and values are views into that buffer, so lines may be of any
+ * length. The [[key]] arrays of roots are children of the root wherever
+ * they are, any other one nests in the table before it.
+ */
+TomlArray*
+tomlopen(FILE *fp, const char **roots)
+{
+	TomlArena *arena;
+	TomlArray *root;
+
+	if (!(arena = calloc(1, sizeof(TomlArena))))
+		return NULL;
+
+	if (!(arena->buf = readfile(fp, &arena->len)) || !(root = createarray(NULL, arena))) {
+		freearena(arena);
+		return NULL;
+	}
+
+	arena->cur = root;
+	arena->roots = roots;
+	return root;
+}
+
+/* parses the rest of the document, returns 1 if it is malformed */
+int
+tomlparse(TomlArray *root)
+{
+	TomlArray *last;
+
+	return parse(root, NULL, &last);
+}
+
+/* looks up the interned id of every field key once per document */
+void
+tomlresolve(TomlArray *arr, TomlField *fields, size_t nfield)
+{
+	TomlArena *arena = arr->arena;
+	size_t slot;
+
+	for (size_t i = 0; i < nfield; i++) {
+		fields[i].id = 0;
+		if (!arena->nslot)
+			continue;
+
+		slot = findslot(arena, fields[i].key, strlen(fields[i].key));
+		fields[i].id = arena->slots[slot];
 	}
-	return 2;
 }
@@ -3,39 +3,91 @@
 
 #include <stdio.h>
 
+enum { TOML_BOOL, TOML_DOUBLE, TOML_ENUM, TOML_STRING, TOML_UINT };
+
+typedef struct TomlArena TomlArena;
+typedef struct TomlEnum TomlEnum;
+typedef struct TomlField TomlField;
+typedef struct TomlView TomlView;
 typedef struct TomlKeyVal TomlKeyVal;
 typedef struct TomlArray TomlArray;
 typedef struct TomlArrayKey TomlArrayKey;
 
+/* a span of the file contents, nothing is copied out of it while parsing */
+struct TomlView {
+	size_t off;
+	size_t len;
+};
+
 struct TomlKeyVal {
-	char *key;
-	char *val;
+	TomlView key;
+	TomlView val;
+
+	/* the interned key, equal keys of a document share it */
+	unsigned int id;
 };
 
 struct TomlArray {
 	TomlArray *parentarr;
 
-	TomlKeyVal **item;
-	TomlArrayKey **key;
+	/* the file contents and every node of the document */
+	char *buf;
+	TomlArena *arena;
+
+	TomlKeyVal *item;
+	TomlArrayKey *key;
 
 	size_t nitem;
 	size_t nkey;
+	size_t capitem;
+	size_t capkey;
 };
 
 struct TomlArrayKey {
-	char *key;
+	TomlView key;
 
 	TomlArray **arr;
 	size_t narr;
+	size_t caparr;
+};
+
+struct TomlEnum {
+	const char *name;
+	unsigned int value;
+};
+
+/*
+ * one option of a schema, filled in from an array by tomlextract().
+ * uint, bool and enum options are stored as unsigned int, strings are
+ * allocated and belong to the caller.
+ */
+struct TomlField {
+	const char *key;
+	int type;
+	size_t offset;
+
+	/* the names of an enum option, terminated by a NULL name */
+	const TomlEnum *enums;
+
+	/* set by tomlresolve() */
+	unsigned int id;
+
+	/* set by tomlextract(), 0 if stored, 1 if invalid, 2 if missing */
+	int status;
 };
 
 void tomldeletearray(TomlArray *arr);
+int tomlextract(TomlArray *arr, TomlField *fields, size_t nfield, void *dest);
 TomlArrayKey* tomlgetarraykey(TomlArray *arr, const char *key);
 int tomlgetbool(TomlArray *arr, const char *key, unsigned int *ret);
-TomlArray* tomlgetconfig(FILE *fp);
+TomlArray* tomlgetconfig(FILE *fp, const char **roots);
 int tomlgetdouble(TomlArray *arr, const char *key, double *ret);
 int tomlgetstring(TomlArray *arr, const char *key, char **ret);
 int tomlgetuint(TomlArray *arr, const char *key, unsigned int *ret);
+TomlArray* tomlnext(TomlArray *root, const char *key);
+TomlArray* tomlopen(FILE *fp, const char **roots);
+int tomlparse(TomlArray *root);
+void tomlresolve(TomlArray *arr, TomlField *fields, size_t nfield);
 
 
 #endif /* TOML_H */